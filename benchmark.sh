@@ -0,0 +1,65 @@
+#!/bin/bash
+# Benchmark harness for smallsh hot paths. Generates synthetic batch scripts
+# and times smallsh over each one, reporting ns per line and (when
+# /usr/bin/time is available) max RSS, so parse/expansion/spawn/reap
+# regressions show up numerically.
+#
+# Usage: ./benchmark.sh [path-to-smallsh]   (or just: make bench)
+
+SMALLSH=${1:-./smallsh}
+
+# lines per phase: parse-style phases are cheap, spawn-style phases fork real
+# processes and stay smaller to keep the whole run under a minute
+PARSE_LINES=100000
+EXPAND_LINES=100000
+SPAWN_LINES=5000
+REAP_LINES=2000
+
+if [ ! -x "$SMALLSH" ]; then
+    echo "benchmark.sh: $SMALLSH is not executable (run make first)" >&2
+    exit 1
+fi
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+# runs one phase: times smallsh over the script and prints ns/op and max RSS
+run_phase() {
+    name=$1
+    script=$2
+    ops=$3
+
+    if command -v /usr/bin/time > /dev/null; then
+        start=$(date +%s%N)
+        /usr/bin/time -f "%M" -o "$workdir/rss" "$SMALLSH" "$script" > /dev/null
+        end=$(date +%s%N)
+        rss="$(cat "$workdir/rss") kB"
+    else
+        start=$(date +%s%N)
+        "$SMALLSH" "$script" > /dev/null
+        end=$(date +%s%N)
+        rss="n/a"
+    fi
+
+    printf "%-28s %10d ops %12d ns/op   max RSS %s\n" \
+        "$name" "$ops" $(( (end - start) / ops )) "$rss"
+}
+
+# parse-only: builtin lines exercise the tokenizer and dispatch with no spawn
+seq $PARSE_LINES | sed 's/.*/status one two three four/' > "$workdir/parse.sh"
+
+# expansion-heavy: every line is dense with $$ for the expansion engine
+seq $EXPAND_LINES | sed 's/.*/status $$\/$$\/$$ $$-$$ $$$$$$/' > "$workdir/expand.sh"
+
+# spawn loop: tight /bin/true launches through the posix_spawn path
+seq $SPAWN_LINES | sed 's|.*|/bin/true|' > "$workdir/spawn.sh"
+
+# background storm: & jobs flood the scheduler and SIGCHLD reaper, then wait
+seq $REAP_LINES | sed 's|.*|/bin/true \&|' > "$workdir/reap.sh"
+echo "wait" >> "$workdir/reap.sh"
+
+echo "smallsh benchmark ($SMALLSH)"
+run_phase "parse (builtin lines)"   "$workdir/parse.sh"  "$PARSE_LINES"
+run_phase "expansion (\$\$-heavy)"  "$workdir/expand.sh" "$EXPAND_LINES"
+run_phase "spawn (/bin/true loop)"  "$workdir/spawn.sh"  "$SPAWN_LINES"
+run_phase "reap (background storm)" "$workdir/reap.sh"   "$REAP_LINES"
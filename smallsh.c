@@ -4,340 +4,3178 @@
  *              where < and > signal input and output (and are optional), & signals to run
  *              in the background (also optional). Any instance of "$$" will be replaced
  *              with the PID of the shell process. 
- *              
+ *
  * Compile:  gcc --std=gnu99 smallsh.c -o smallsh
- * Run:      ./smallsh
+ * Run:      ./smallsh                   (interactive)
+ *           ./smallsh script.sh         (batch mode, run commands from a script)
+ *           ./smallsh -c "command"      (batch mode, run a single command string)
+ *           ./smallsh < script.sh       (batch mode, non-tty stdin)
  * **************************************************************************************/
+#define _GNU_SOURCE //pipe2
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h> //fork, getpid, chdir
 #include <sys/types.h> //pid_t
 #include <sys/wait.h> //waitpid
+#include <sys/resource.h> //wait4, struct rusage
+#include <sys/mman.h> //mmap'd command journal
 #include <fcntl.h> //file functions
 #include <signal.h> //for sigaction
-
+#include <errno.h> //errno preservation in signal handlers
+#include <spawn.h>
+#include <sys/socket.h>
+#include <dirent.h> //posix_spawn fast path for external commands
+#include <termios.h> //raw-mode terminal input for the interactive line editor
+#include <sys/uio.h> //writev for batched console output
+#include <time.h> //clock_gettime for hot-path latency histograms
+
+//environment handed to posix_spawn'd children
+extern char **environ;
+
+//dirent.h drags in limits.h, whose unrelated MAX_INPUT (the tty type-ahead
+//buffer size) collides with ours. MAX_INPUT only bounds the interactive line
+//editor and history entries now: batch lines and argv grow without limit
+#undef MAX_INPUT
 #define MAX_INPUT 2048
+
+//initial argv capacity; the array doubles on demand past it
 #define MAX_ARGS 512
+#define MAX_PIPELINE_STAGES 16
+
+//interactive history ring: fixed-size block inside struct shell, newest entry
+//overwrites the oldest once full, no per-entry allocation
+#define HISTORY_ENTRIES 64
+
+//size of the arena's static first chunk (and the minimum size of the
+//malloc'd overflow chunks behind it). the common command never leaves the
+//first chunk, so the hot path stays allocation free
+#define ARENA_SIZE (MAX_INPUT * 8)
+
+// the sig handler cannot be passed variables, so foreground flag must be global.
+// the SIGTSTP handler only flips these; the main loop prints the banner at the
+// next safe point (see reportModeToggle), so the handler never blocks on a write
+volatile sig_atomic_t fgFlag = 0;
+volatile sig_atomic_t fgFlagPending = 0;
+
+//ring buffer the SIGCHLD handler pushes reaped background children in to.
+//single writer (the handler) and single reader (the main loop), and each index
+//is only advanced by its owner, so no locking is needed
+#define REAP_RING_SIZE 128
+
+struct reapedProcess{
+    pid_t pid;
+    int status;
+    struct rusage usage;
+};
+
+struct reapedProcess reapRing[REAP_RING_SIZE];
+volatile sig_atomic_t reapRingHead = 0; //next slot the handler writes
+volatile sig_atomic_t reapRingTail = 0; //next slot the main loop reads
+
+
+/*
+ * Custom handler for SIGCHLD. Collects every child that has already exited in
+ * to the reap ring so the main loop only spends syscalls on children that
+ * actually finished, instead of polling every tracked pid each prompt. Only
+ * background children can reach this handler: foreground commands run with
+ * SIGCHLD blocked until the parent has reaped them itself
+ */
+void handle_SIGCHLD(int signo){
+    int savedErrno = errno;
+    int childStatus;
+    pid_t childPID;
+
+    struct rusage childUsage;
+
+    while((childPID = wait4(-1, &childStatus, WNOHANG, &childUsage)) > 0){
+        int next = (reapRingHead + 1) % REAP_RING_SIZE;
+
+        //if the ring is somehow full, leave the rest as zombies; the next
+        //SIGCHLD will retry after the main loop has drained some entries
+        if(next == reapRingTail)
+            break;
+
+        reapRing[reapRingHead].pid = childPID;
+        reapRing[reapRingHead].status = childStatus;
+        reapRing[reapRingHead].usage = childUsage;
+        reapRingHead = next;
+    }
+
+    errno = savedErrno;
+}
+
+//output batcher: console messages accumulate as iovec entries — static text
+//referenced in place, integers rendered in to a side buffer — and go out in a
+//single writev, so a burst of completion reports costs one syscall total
+#define OUTPUT_IOV_MAX 64
+#define OUTPUT_NUMBERS_SIZE 1024
+
+struct outputBatch{
+    struct iovec iov[OUTPUT_IOV_MAX];
+    int iovCount;
+    char numbers[OUTPUT_NUMBERS_SIZE]; //rendered integers live here until flushed
+    int numbersUsed;
+};
+
+//appends a string literal without a runtime strlen
+#define outputAppendLiteral(shell, literal) outputAppend(shell, literal, sizeof(literal) - 1)
+
+//always-on hot-path instrumentation: nanosecond latencies accumulate in to
+//fixed log2 histograms — one array increment per sample, no allocation and no
+//I/O anywhere near the hot path. 2^40 ns is over 18 minutes, enough headroom
+#define HISTOGRAM_BUCKETS 40
+
+struct latencyHistogram{
+    long count;
+    long totalNs;
+    long buckets[HISTOGRAM_BUCKETS];
+};
+
+//job table: open-addressed hash set of live background pids, indexed by pid
+//for O(1) insert and remove. 0 marks an empty slot and -1 a removed one. the
+//table is grown before forking, never on the fork hot path itself
+#define JOB_TABLE_INITIAL_CAPACITY 64
+#define JOB_SLOT_EMPTY 0
+#define JOB_SLOT_REMOVED -1
+
+struct jobTable{
+    pid_t* pids;
+    char** cmds; //command name for each live slot, for the jobs builtin
+    int capacity; //always a power of two so hashing can mask instead of mod
+    int count; //live entries only, not removed slots
+};
+
+//path cache: open-addressed hash map from command name to resolved executable
+//path, so repeated invocations of the same binary skip the PATH walk entirely.
+//entries resolved through a relative PATH directory are flushed on cd
+#define PATH_CACHE_INITIAL_CAPACITY 64
+
+struct pathCacheEntry{
+    char* name; //command name as typed, NULL marks an empty slot
+    char* path; //resolved executable path
+    int relative; //1 if resolved through a relative PATH directory
+};
+
+struct pathCache{
+    struct pathCacheEntry* entries;
+    int capacity; //always a power of two so hashing can mask instead of mod
+    int count;
+};
+
+//background-notification policy: every job individually, one summary line
+//per burst of completions, or nothing at all (the batch-mode default, so
+//captured stdout carries only command output)
+#define NOTIFY_EACH 0
+#define NOTIFY_SUMMARY 1
+#define NOTIFY_OFF 2
+
+//connectors between ";"/"&&"/"||"-chained command segments: ";" always runs
+//the next segment, "&&" only after success, "||" only after failure
+#define CHAIN_ALWAYS 0
+#define CHAIN_AND 1
+#define CHAIN_OR 2
+
+//variable cache: open-addressed hash map from variable name to its interned
+//value, populated lazily from the environment, so repeated expansions of the
+//same variable are a hash hit instead of a getenv scan of the environ block
+#define VAR_CACHE_INITIAL_CAPACITY 64
+#define VAR_NAME_MAX 256
+
+struct varCacheEntry{
+    char* name; //variable name, NULL marks an empty slot
+    char* value; //interned value; "" for variables not in the environment
+    int valueLen;
+};
+
+struct varCache{
+    struct varCacheEntry* entries;
+    int capacity; //always a power of two so hashing can mask instead of mod
+    int count;
+};
+
+//directory stack depth for pushd/popd: each saved directory is held as an
+//O_PATH fd so returning to it is a single fchdir, no per-component path
+//resolution even on a network filesystem
+#define DIR_STACK_MAX 32
+
+//initial size of the memory-mapped command journal; the file doubles as the
+//log outgrows it and is trimmed back to its real length on exit
+#define JOURNAL_INITIAL_CAPACITY 65536
+
+//a background command deferred because the concurrency limit was reached.
+//everything it needs to launch later is deep-copied out of the per-command
+//arena: FIFO nodes wait in a singly linked queue inside struct shell
+struct queuedJob{
+    struct queuedJob* next;
+    char* argStorage; //all argument strings packed back to back
+    char** args; //argv pointers in to argStorage, stage-separating NULLs kept
+    int argCount; //entries in args, including separators
+    char* inputFile;
+    char* outputFile;
+    char* hereString;
+    int numStages;
+    int stageStart[MAX_PIPELINE_STAGES];
+};
+
+//an overflow chunk of the per-command arena: commands too large for the
+//static first chunk chain these behind it. handed-out pointers never move,
+//which is what lets argv slices and chain state survive arena growth
+struct arenaChunk{
+    struct arenaChunk* next;
+    int capacity;
+    int used;
+    char bytes[];
+};
+
+//directory snapshot cache for globbing: each snapshot is one full directory
+//read with the names packed back to back in its own grown-on-demand buffer,
+//so several patterns aimed at the same directory in one command list share
+//a single read. the cache resets at the end of every command cycle
+#define GLOB_CACHE_DIRS 8
+
+struct dirSnapshot{
+    char* path; //directory the snapshot was read from
+    char* names; //entry names packed back to back
+    int count;
+};
 
-// the sig handler cannot be passed variables, so foreground flag must be global
-int fgFlag = 0;
+//preforked executor pool: persistent workers for one designated command,
+//each exec'd exactly once with its stdin wired to a private socketpair.
+//later invocations of that command dispatch their argv as one task line to
+//the next worker round-robin, so a task costs one socket write instead of a
+//fork+exec, and the exec setup (dynamic linking included) is paid once per
+//worker instead of once per task
+#define POOL_MAX_WORKERS 64
+
+struct workerPool{
+    char* command; //designated command name, NULL while no pool runs
+    pid_t workerPids[POOL_MAX_WORKERS];
+    int workerFds[POOL_MAX_WORKERS]; //shell's end of each worker's stdin
+    int numWorkers;
+    int next; //round-robin dispatch cursor
+    long tasksSent;
+};
+
+//a finished parse cached alongside its history ring slot. every expanded
+//string is packed back to back in storage and the shell's command state
+//recorded as offsets in to it, so re-executing the entry through "!!" or
+//"!prefix" restores pointers instead of re-tokenizing and re-expanding
+struct historyParse{
+    int valid;
+    char storage[MAX_INPUT]; //expanded argv/redirect strings, packed
+    short argOffsets[MAX_ARGS]; //offsets in to storage, -1 marks stage NULLs
+    int argCount;
+    short inputFileOffset; //-1 when absent
+    short outputFileOffset;
+    short hereStringOffset;
+    int bgFlag;
+    int numStages;
+    int stageStart[MAX_PIPELINE_STAGES];
+};
 
 // shell struct holds all variables for the small shell
 struct shell{
     int pid;
+
+    //the shell's pid never changes, so its decimal form is rendered once at
+    //startup and spliced in wherever "$$" appears
+    char pidString[12];
+    int pidStringLen;
     int exitShell;
     int exitStatus;
     pid_t childPID;
-    int bgProcesses[50];
+    struct jobTable jobs;
+    struct pathCache paths;
+    struct varCache vars;
+    struct workerPool pool;
+
+    //logical working directory, maintained incrementally on cd so $PWD and
+    //the PWD environment variable never pay a getcwd syscall; prevDirFd is
+    //an O_PATH handle backing "cd -", and the pushd stack holds one O_PATH
+    //fd per saved directory so popd is a single fchdir
+    char cwd[MAX_INPUT];
+    char prevDir[MAX_INPUT];
+    int prevDirFd;
+    int dirStackFds[DIR_STACK_MAX];
+    char* dirStackPaths[DIR_STACK_MAX];
+    int dirStackCount;
+
+    //background scheduler: at most maxBackground jobs run at once, the
+    //overflow waits in a FIFO queue and launches as the reaper frees slots
+    int maxBackground;
+
+    //notification policy (NOTIFY_*) and where job notices go: stdout by
+    //default, or the fd named in SMALLSH_NOTIFY_FD to keep stdout clean
+    int notifyMode;
+    int notifyFd;
+    struct queuedJob* bgQueueHead;
+    struct queuedJob* bgQueueTail;
+    int bgQueueCount;
+
+    //SIGINT disposition the fork fallback restores in foreground children
+    struct sigaction SIGINT_action;
+
+    //batched console output, flushed once per burst with writev
+    struct outputBatch out;
+
+    //where each command's time went: tokenizing, launching, waiting
+    struct latencyHistogram parseHist;
+    struct latencyHistogram spawnHist;
+    struct latencyHistogram waitHist;
+
+    //per-child resource accounting, captured by wait4 at reap time instead
+    //of wrapping commands in /usr/bin/time: running totals plus the peak
+    //resident set across every reaped child, dumped by the stats builtin
+    long childUserUs;
+    long childSysUs;
+    long childMaxRssKb;
+    long childrenAccounted;
+    int rusageReport; //1: print a usage line after each foreground command
+
     int bgFlag;
-    char* cmdLineArgs[MAX_ARGS];
+
+    //argv grows by doubling past its initial capacity, and the count of
+    //entries a command actually used makes reset O(actual args)
+    char** cmdLineArgs;
+    int cmdLineArgsCapacity;
+    int cmdLineArgCount;
     char* inputFile;
     char* outputFile;
+
+    //here-string payload ("cmd <<< word"): lives in the parse arena and is
+    //fed to the child through herePipe, no temp file involved
+    char* hereString;
+    int herePipe[2];
+
+    //redirect targets pre-opened in the parent before the launch, -1 when
+    //absent: children dup2 ready fds instead of paying opens post-fork
+    int inputFd;
+    int outputFd;
+
+    //pipeline bookkeeping: each "|"-separated stage's argv starts at
+    //cmdLineArgs[stageStart[x]] and runs to a NULL separator entry.
+    //stageOverflow marks a parse that ran out of stage slots
+    int numStages;
+    int stageStart[MAX_PIPELINE_STAGES];
+    int stageOverflow;
+
+    //command-list chaining: tokenizing stops at ";", "&&", or "||" and the
+    //unparsed rest of the line waits here; chainOp is the connector that
+    //decides whether the next segment runs given the last exit status
+    char* chainRest;
+    int chainOp;
+
+    //per-command arena all token/file strings are carved from, reclaimed in
+    //one shot by commandLineArgumentReset instead of per-string free calls.
+    //commands too large for the static chunk chain overflow chunks behind it
+    char arena[ARENA_SIZE];
+    int arenaUsed;
+    struct arenaChunk* arenaOverflow;
+
+    //glob snapshots reset along with the arena at the end of the cycle
+    struct dirSnapshot dirSnapshots[GLOB_CACHE_DIRS];
+    int dirSnapshotCount;
+
+    //interactive is 1 when reading commands from a terminal, 0 in batch mode.
+    //in batch mode the whole script lives in scriptBuffer, and a preflight
+    //pass at load time splits it in to an index of executable lines —
+    //comments and blanks are dropped up front, so the inter-command path is
+    //one array fetch with no per-line scanning or I/O syscalls
+    int interactive;
+    char* scriptBuffer;
+    char** scriptLines;
+    int scriptLineCount;
+    int scriptLineNext;
+
+    //crash-safe command journal (--journal/--resume): a memory-mapped
+    //append-only log recording each batch line on dispatch and its status on
+    //completion, so a restarted run can skip work that already finished.
+    //appending is a memcpy plus an asynchronous msync, not a write syscall
+    //per command
+    int journalFd;
+    char* journalMap;
+    long journalCapacity;
+    long journalUsed;
+    int journalSkipLines;
+
+    //interactive line editor state: the history ring and the append-only
+    //history file (-1 when unavailable)
+    char history[HISTORY_ENTRIES][MAX_INPUT];
+    int historyCount; //total lines ever added; ring slots index modulo this
+    int historyFd;
+
+    //history recall: each entry's first byte mirrored in a side array so
+    //"!prefix" lookups skip non-candidates with one byte compare, and a
+    //cached parse per ring slot so recalled commands skip tokenization
+    char historyFirstByte[HISTORY_ENTRIES];
+    struct historyParse historyParses[HISTORY_ENTRIES];
 };
 
-/* 
- * Sets up a small shell struct, assigns memory, then returns pointer to the new shell
+
+/*
+ * Carves size bytes out of the shell's per-command arena and returns a
+ * pointer to them. The common command fits the static first chunk and costs
+ * a pointer bump; larger commands chain malloc'd overflow chunks behind it,
+ * so no command is ever too big. Handed-out pointers never move
+ */
+char* arenaAlloc(struct shell* shell, int size){
+    //fast path: the static first chunk
+    if(shell->arenaOverflow == NULL && shell->arenaUsed + size <= ARENA_SIZE){
+        char* mem = shell->arena + shell->arenaUsed;
+        shell->arenaUsed += size;
+        return mem;
+    }
+
+    //overflow: carve from the newest chunk, adding another when it's full
+    struct arenaChunk* chunk = shell->arenaOverflow;
+    if(chunk == NULL || chunk->used + size > chunk->capacity){
+        int capacity = size > ARENA_SIZE ? size : ARENA_SIZE;
+        chunk = malloc(sizeof(struct arenaChunk) + capacity);
+        chunk->capacity = capacity;
+        chunk->used = 0;
+        chunk->next = shell->arenaOverflow;
+        shell->arenaOverflow = chunk;
+    }
+
+    char* mem = chunk->bytes + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+
+/*
+ * Makes sure argv can hold at least needed entries, allocating on first use
+ * and doubling past that. New slots start NULL so the walk-to-NULL loops
+ * elsewhere keep working; the live argv pointers survive the realloc because
+ * the strings they reference live in the arena, not the array
+ */
+void argvEnsureCapacity(struct shell* shell, int needed){
+    if(shell->cmdLineArgsCapacity >= needed)
+        return;
+
+    int capacity = shell->cmdLineArgsCapacity == 0 ?
+                   MAX_ARGS : shell->cmdLineArgsCapacity;
+    while(capacity < needed)
+        capacity *= 2;
+
+    shell->cmdLineArgs = realloc(shell->cmdLineArgs, capacity * sizeof(char*));
+    memset(shell->cmdLineArgs + shell->cmdLineArgsCapacity, '\0',
+           (capacity - shell->cmdLineArgsCapacity) * sizeof(char*));
+    shell->cmdLineArgsCapacity = capacity;
+}
+
+
+/*
+ * Returns the CLOCK_MONOTONIC time in nanoseconds
+ */
+long monotonicNs(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+
+/*
+ * Adds one latency sample to a histogram: a count bump and a single-bit log2
+ * bucket computation, a few nanoseconds per call
+ */
+void histogramRecord(struct latencyHistogram* hist, long ns){
+    int bucket = 0;
+    if(ns > 0)
+        bucket = 63 - __builtin_clzl(ns);
+    if(bucket >= HISTOGRAM_BUCKETS)
+        bucket = HISTOGRAM_BUCKETS - 1;
+
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->totalNs += ns;
+}
+
+
+/*
+ * Renders an int in to out without going through printf. Returns the length
+ */
+int fastItoa(int value, char* out){
+    char reversed[12];
+    int n = 0;
+    int len = 0;
+
+    unsigned int magnitude = value;
+    if(value < 0){
+        out[len++] = '-';
+        magnitude = -(unsigned int)value;
+    }
+
+    //render the digits backwards, then flip them in to place
+    do{
+        reversed[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while(magnitude > 0);
+
+    while(n > 0)
+        out[len++] = reversed[--n];
+
+    return len;
+}
+
+
+/*
+ * Emits everything batched so far with one writev and resets the batch.
+ * stdout's stdio buffer is flushed first so ordering with printf output holds
+ */
+void outputFlush(struct shell* shell){
+    if(shell->out.iovCount == 0)
+        return;
+
+    fflush(stdout);
+    writev(STDOUT_FILENO, shell->out.iov, shell->out.iovCount);
+    shell->out.iovCount = 0;
+    shell->out.numbersUsed = 0;
+}
+
+
+/*
+ * Adds a string of known length to the output batch. The bytes are referenced
+ * in place, not copied, so they must stay valid until the flush
+ */
+void outputAppend(struct shell* shell, char* str, int len){
+    if(shell->out.iovCount == OUTPUT_IOV_MAX)
+        outputFlush(shell);
+
+    shell->out.iov[shell->out.iovCount].iov_base = str;
+    shell->out.iov[shell->out.iovCount].iov_len = len;
+    shell->out.iovCount++;
+}
+
+
+/*
+ * Renders an int in to the batch's number buffer and adds it as an entry
+ */
+void outputAppendInt(struct shell* shell, int value){
+    if(shell->out.iovCount == OUTPUT_IOV_MAX ||
+       shell->out.numbersUsed + 12 > OUTPUT_NUMBERS_SIZE)
+        outputFlush(shell);
+
+    char* rendered = shell->out.numbers + shell->out.numbersUsed;
+    int len = fastItoa(value, rendered);
+    shell->out.numbersUsed += len;
+
+    outputAppend(shell, rendered, len);
+}
+
+/*
+ * Hashes a pid to a starting slot in a job table of the given capacity
+ */
+int jobTableHash(pid_t pid, int capacity){
+    //Knuth multiplicative hash, masked down to the power-of-two capacity
+    return ((unsigned int)pid * 2654435761u) & (capacity - 1);
+}
+
+
+/*
+ * Allocates a job table slot array of the given capacity with every slot empty
+ */
+void jobTableInit(struct jobTable* jobs, int capacity){
+    jobs->pids = calloc(capacity, sizeof(pid_t));
+    jobs->cmds = calloc(capacity, sizeof(char*));
+    jobs->capacity = capacity;
+    jobs->count = 0;
+}
+
+
+/*
+ * Doubles the job table whenever it is more than half full, rehashing the live
+ * pids in to the new slot array. Called before forking so the fork hot path
+ * itself never allocates. Also where the table is first allocated, keeping
+ * shell startup allocation-free
+ */
+void jobTableEnsureCapacity(struct jobTable* jobs){
+    if(jobs->capacity == 0){
+        jobTableInit(jobs, JOB_TABLE_INITIAL_CAPACITY);
+        return;
+    }
+
+    if(jobs->count * 2 < jobs->capacity)
+        return;
+
+    struct jobTable grown;
+    jobTableInit(&grown, jobs->capacity * 2);
+
+    //rehash every live pid, dropping removed-slot markers along the way
+    for(int x = 0; x < jobs->capacity; x++){
+        if(jobs->pids[x] != JOB_SLOT_EMPTY && jobs->pids[x] != JOB_SLOT_REMOVED){
+            int slot = jobTableHash(jobs->pids[x], grown.capacity);
+            while(grown.pids[slot] != JOB_SLOT_EMPTY)
+                slot = (slot + 1) & (grown.capacity - 1);
+            grown.pids[slot] = jobs->pids[x];
+            grown.cmds[slot] = jobs->cmds[x];
+            grown.count++;
+        }
+    }
+
+    free(jobs->pids);
+    free(jobs->cmds);
+    *jobs = grown;
+}
+
+
+/*
+ * Records a live background pid in the job table. The table is kept less than
+ * half full by jobTableEnsureCapacity, so probing is O(1) and a free slot
+ * always exists
+ */
+void jobTableAdd(struct jobTable* jobs, pid_t pid, char* cmd){
+    int slot = jobTableHash(pid, jobs->capacity);
+
+    //probe for the first reusable slot
+    while(jobs->pids[slot] != JOB_SLOT_EMPTY && jobs->pids[slot] != JOB_SLOT_REMOVED)
+        slot = (slot + 1) & (jobs->capacity - 1);
+
+    jobs->pids[slot] = pid;
+
+    //the command name outlives the per-command arena, so it gets a heap copy
+    jobs->cmds[slot] = strdup(cmd);
+    jobs->count++;
+}
+
+
+/*
+ * Removes a reaped background pid from the job table, leaving a removed-slot
+ * marker so later probe chains stay intact. Returns 1 if the pid was tracked,
+ * 0 if it belonged to something else (like a worker-pool child)
+ */
+int jobTableRemove(struct jobTable* jobs, pid_t pid){
+    if(jobs->capacity == 0)
+        return 0;
+
+    int slot = jobTableHash(pid, jobs->capacity);
+
+    //probe until the pid is found or the chain ends at an empty slot
+    while(jobs->pids[slot] != JOB_SLOT_EMPTY){
+        if(jobs->pids[slot] == pid){
+            jobs->pids[slot] = JOB_SLOT_REMOVED;
+            free(jobs->cmds[slot]);
+            jobs->cmds[slot] = NULL;
+            jobs->count--;
+            return 1;
+        }
+        slot = (slot + 1) & (jobs->capacity - 1);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Returns 1 if the given pid is a live entry in the job table
+ */
+int jobTableContains(struct jobTable* jobs, pid_t pid){
+    if(jobs->capacity == 0)
+        return 0;
+
+    int slot = jobTableHash(pid, jobs->capacity);
+
+    while(jobs->pids[slot] != JOB_SLOT_EMPTY){
+        if(jobs->pids[slot] == pid)
+            return 1;
+        slot = (slot + 1) & (jobs->capacity - 1);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Hashes a command name to a starting slot in a path cache of the given
+ * capacity (djb2)
+ */
+int pathCacheHash(char* name, int capacity){
+    unsigned int hash = 5381;
+    for(char* c = name; *c != '\0'; c++)
+        hash = hash * 33 + (unsigned char)*c;
+    return hash & (capacity - 1);
+}
+
+
+/*
+ * Allocates a path cache slot array of the given capacity with every slot empty
+ */
+void pathCacheInit(struct pathCache* cache, int capacity){
+    cache->entries = calloc(capacity, sizeof(struct pathCacheEntry));
+    cache->capacity = capacity;
+    cache->count = 0;
+}
+
+
+/*
+ * Returns the cached executable path for a command name, or NULL on a miss
+ */
+char* pathCacheLookup(struct pathCache* cache, char* name){
+    int slot = pathCacheHash(name, cache->capacity);
+
+    while(cache->entries[slot].name != NULL){
+        if(strcmp(cache->entries[slot].name, name) == 0)
+            return cache->entries[slot].path;
+        slot = (slot + 1) & (cache->capacity - 1);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Caches a resolved executable path under a command name, doubling the table
+ * when it gets half full. Returns the cache's own copy of the path
+ */
+char* pathCacheInsert(struct pathCache* cache, char* name, char* path, int relative){
+    //double and rehash when the table is half full
+    if(cache->count * 2 >= cache->capacity){
+        struct pathCache grown;
+        pathCacheInit(&grown, cache->capacity * 2);
+
+        for(int x = 0; x < cache->capacity; x++){
+            if(cache->entries[x].name != NULL){
+                int slot = pathCacheHash(cache->entries[x].name, grown.capacity);
+                while(grown.entries[slot].name != NULL)
+                    slot = (slot + 1) & (grown.capacity - 1);
+                grown.entries[slot] = cache->entries[x];
+                grown.count++;
+            }
+        }
+
+        free(cache->entries);
+        *cache = grown;
+    }
+
+    int slot = pathCacheHash(name, cache->capacity);
+    while(cache->entries[slot].name != NULL)
+        slot = (slot + 1) & (cache->capacity - 1);
+
+    //cached strings outlive the per-command arena, so they get their own heap copies
+    cache->entries[slot].name = strdup(name);
+    cache->entries[slot].path = strdup(path);
+    cache->entries[slot].relative = relative;
+    cache->count++;
+
+    return cache->entries[slot].path;
+}
+
+
+/*
+ * Empties the path cache. With relativeOnly set, only drops entries that were
+ * resolved through a relative PATH directory (their resolution depends on the
+ * working directory, so cd invalidates them); the survivors are rehashed in
+ * place
+ */
+void pathCacheFlush(struct pathCache* cache, int relativeOnly){
+    if(cache->capacity == 0)
+        return;
+
+    struct pathCacheEntry* oldEntries = cache->entries;
+    int oldCapacity = cache->capacity;
+
+    pathCacheInit(cache, cache->capacity);
+
+    for(int x = 0; x < oldCapacity; x++){
+        if(oldEntries[x].name == NULL)
+            continue;
+
+        //keep absolute entries on a relative-only flush
+        if(relativeOnly && !oldEntries[x].relative){
+            int slot = pathCacheHash(oldEntries[x].name, cache->capacity);
+            while(cache->entries[slot].name != NULL)
+                slot = (slot + 1) & (cache->capacity - 1);
+            cache->entries[slot] = oldEntries[x];
+            cache->count++;
+        }
+        else{
+            free(oldEntries[x].name);
+            free(oldEntries[x].path);
+        }
+    }
+
+    free(oldEntries);
+}
+
+
+/*
+ * Hashes a length-delimited variable name to a starting slot in a variable
+ * cache of the given capacity (djb2). Length-delimited because names arrive
+ * sliced out of the middle of a token, not NUL terminated
+ */
+int varCacheHash(char* name, int nameLen, int capacity){
+    unsigned int hash = 5381;
+    for(int x = 0; x < nameLen; x++)
+        hash = hash * 33 + (unsigned char)name[x];
+    return hash & (capacity - 1);
+}
+
+
+/*
+ * Allocates a variable cache slot array of the given capacity, every slot empty
+ */
+void varCacheInit(struct varCache* cache, int capacity){
+    cache->entries = calloc(capacity, sizeof(struct varCacheEntry));
+    cache->capacity = capacity;
+    cache->count = 0;
+}
+
+
+/*
+ * Returns the interned cache entry for a variable name, consulting the
+ * environment and interning the result on a miss. Unset variables intern as ""
+ * so repeated expansions of them skip the environ scan too
+ */
+struct varCacheEntry* varCacheLookup(struct varCache* cache, char* name, int nameLen){
+    if(cache->capacity == 0)
+        varCacheInit(cache, VAR_CACHE_INITIAL_CAPACITY);
+
+    //double and rehash when the table is half full, before probing
+    if(cache->count * 2 >= cache->capacity){
+        struct varCache grown;
+        varCacheInit(&grown, cache->capacity * 2);
+
+        for(int x = 0; x < cache->capacity; x++){
+            if(cache->entries[x].name != NULL){
+                struct varCacheEntry* entry = &cache->entries[x];
+                int slot = varCacheHash(entry->name, strlen(entry->name), grown.capacity);
+                while(grown.entries[slot].name != NULL)
+                    slot = (slot + 1) & (grown.capacity - 1);
+                grown.entries[slot] = *entry;
+                grown.count++;
+            }
+        }
+
+        free(cache->entries);
+        *cache = grown;
+    }
+
+    int slot = varCacheHash(name, nameLen, cache->capacity);
+    while(cache->entries[slot].name != NULL){
+        if(strncmp(cache->entries[slot].name, name, nameLen) == 0 &&
+           cache->entries[slot].name[nameLen] == '\0')
+            return &cache->entries[slot];
+        slot = (slot + 1) & (cache->capacity - 1);
+    }
+
+    //miss: one getenv scan, then the result is interned for the shell's lifetime
+    char nameBuffer[VAR_NAME_MAX];
+    memcpy(nameBuffer, name, nameLen);
+    nameBuffer[nameLen] = '\0';
+
+    char* value = getenv(nameBuffer);
+    if(value == NULL)
+        value = "";
+
+    cache->entries[slot].name = strdup(nameBuffer);
+    cache->entries[slot].value = strdup(value);
+    cache->entries[slot].valueLen = strlen(value);
+    cache->count++;
+
+    return &cache->entries[slot];
+}
+
+
+/*
+ * Interns or overwrites a variable in the expansion cache without consulting
+ * the environment, so shell-maintained variables like PWD stay in sync with
+ * a setenv instead of serving the stale interned value
+ */
+void varCacheStore(struct varCache* cache, char* name, char* value){
+    struct varCacheEntry* entry = varCacheLookup(cache, name, strlen(name));
+    free(entry->value);
+    entry->value = strdup(value);
+    entry->valueLen = strlen(value);
+}
+
+
+/*
+ * Sets up the small shell and returns a pointer to it. The shell lives in
+ * zero-initialized static storage: no allocation happens here, and only the
+ * few fields with nonzero defaults get touched, so a "smallsh -c 'cmd'"
+ * invocation reaches its first exec with near-zero setup cost. The job table,
+ * path cache, pid string, and background limit all initialize lazily on first
+ * use
+ */
+struct shell* shellSetUp(){
+    static struct shell shellInstance;
+    struct shell* shell = &shellInstance;
+
+    shell->pid = getpid();
+    shell->childPID = -5;
+
+    //assume interactive until main determines otherwise
+    shell->interactive = 1;
+
+    //no history file until main opens one for an interactive session
+    shell->historyFd = -1;
+
+    //per-job notices on stdout until main applies the mode defaults
+    shell->notifyMode = NOTIFY_EACH;
+    shell->notifyFd = STDOUT_FILENO;
+
+    //no previous directory held for "cd -" yet
+    shell->prevDirFd = -1;
+
+    //no command journal unless --journal or --resume asks for one
+    shell->journalFd = -1;
+
+    //no here-string pipe or pre-opened redirect fds outstanding
+    shell->herePipe[0] = -1;
+    shell->herePipe[1] = -1;
+    shell->inputFd = -1;
+    shell->outputFd = -1;
+
+    return shell;
+}
+
+
+/*
+ * Reads everything from the given file descriptor in to one large block buffer
+ * so batch mode can iterate lines out of memory instead of making a read
+ * syscall per line. Returns the NUL-terminated buffer, which the caller owns
+ */
+char* readAllInput(int fd){
+    int capacity = 65536;
+    int used = 0;
+    char* buffer = malloc(capacity);
+
+    //read in large blocks, doubling the buffer whenever it fills up
+    while(1){
+        int bytesRead = read(fd, buffer + used, capacity - used - 1);
+
+        if(bytesRead < 0){
+            perror("smallsh: read");
+            exit(1);
+        }
+        if(bytesRead == 0)
+            break;
+
+        used += bytesRead;
+        if(used >= capacity - 1){
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+
+    buffer[used] = '\0';
+    return buffer;
+}
+
+
+/*
+ * Loads the script file at the given path in to the shell's script buffer and
+ * switches the shell to batch mode
+ */
+void loadScriptFile(struct shell* shell, char* path){
+    int fd = open(path, O_RDONLY);
+    if(fd == -1){
+        fprintf(stderr, "smallsh: cannot open %s\n", path);
+        exit(1);
+    }
+
+    shell->scriptBuffer = readAllInput(fd);
+    shell->interactive = 0;
+    close(fd);
+}
+
+
+/*
+ * Preflight pass over the loaded script: slices every line in place (writing
+ * a NUL over each newline) and builds an index of the executable ones,
+ * dropping comments and blanks before the run even starts. One sequential
+ * sweep over memory the script load just touched — after it, stepping to the
+ * next command is an array fetch instead of a scan-and-test per line
+ */
+void preflightScript(struct shell* shell){
+    int capacity = 256;
+    shell->scriptLines = malloc(capacity * sizeof(char*));
+    shell->scriptLineCount = 0;
+    shell->scriptLineNext = 0;
+
+    char* cursor = shell->scriptBuffer;
+    while(*cursor != '\0'){
+        char* line = cursor;
+        char* lineEnd = strchr(line, '\n');
+
+        if(lineEnd != NULL){
+            *lineEnd = '\0';
+            cursor = lineEnd + 1;
+        }
+        else{
+            cursor = line + strlen(line);
+        }
+
+        //comments and empty lines never reach the main loop
+        if(line[0] == '\0' || line[0] == '#')
+            continue;
+
+        if(shell->scriptLineCount == capacity){
+            capacity *= 2;
+            shell->scriptLines = realloc(shell->scriptLines, capacity * sizeof(char*));
+        }
+        shell->scriptLines[shell->scriptLineCount++] = line;
+    }
+}
+
+
+/*
+ * Makes room for len more journal bytes, doubling the file and remapping
+ * when the log outgrows the current mapping. Growth is rare; the steady
+ * state appends in to pages that are already mapped and dirty
+ */
+void journalEnsureCapacity(struct shell* shell, int len){
+    if(shell->journalUsed + len <= shell->journalCapacity)
+        return;
+
+    long capacity = shell->journalCapacity;
+    while(shell->journalUsed + len > capacity)
+        capacity *= 2;
+
+    munmap(shell->journalMap, shell->journalCapacity);
+    if(ftruncate(shell->journalFd, capacity) == -1 ||
+       (shell->journalMap = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, shell->journalFd, 0)) == MAP_FAILED){
+        fprintf(stderr, "smallsh: cannot grow journal\n");
+        exit(1);
+    }
+    shell->journalCapacity = capacity;
+}
+
+
+/*
+ * Records one batch line as dispatched: "+ <index> <line>". Written before
+ * tokenization slices the line apart, so the journal holds the command as
+ * the script stated it
+ */
+void journalRecordDispatch(struct shell* shell, int index, char* line){
+    char prefix[32];
+    int prefixLen = snprintf(prefix, sizeof(prefix), "+ %d ", index);
+    int lineLen = strlen(line);
+
+    journalEnsureCapacity(shell, prefixLen + lineLen + 1);
+    memcpy(shell->journalMap + shell->journalUsed, prefix, prefixLen);
+    shell->journalUsed += prefixLen;
+    memcpy(shell->journalMap + shell->journalUsed, line, lineLen);
+    shell->journalUsed += lineLen;
+    shell->journalMap[shell->journalUsed++] = '\n';
+}
+
+
+/*
+ * Records one batch line as complete: "= <index> <status>". The asynchronous
+ * msync nudges the dirty pages toward disk without blocking, so after a
+ * crash the journal holds every completion except at most the one in flight
+ */
+void journalRecordComplete(struct shell* shell, int index, int status){
+    char record[32];
+    int len = snprintf(record, sizeof(record), "= %d %d\n", index, status);
+
+    journalEnsureCapacity(shell, len);
+    memcpy(shell->journalMap + shell->journalUsed, record, len);
+    shell->journalUsed += len;
+
+    msync(shell->journalMap, shell->journalUsed, MS_ASYNC);
+}
+
+
+/*
+ * Opens a fresh journal for the given script: the file is created, sized,
+ * mapped, and stamped with a header naming the script so --resume can reload
+ * it from the journal alone
+ */
+void journalOpen(struct shell* shell, char* path, char* scriptPath){
+    shell->journalFd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(shell->journalFd == -1){
+        fprintf(stderr, "smallsh: cannot open journal %s\n", path);
+        exit(1);
+    }
+
+    shell->journalCapacity = JOURNAL_INITIAL_CAPACITY;
+    if(ftruncate(shell->journalFd, shell->journalCapacity) == -1 ||
+       (shell->journalMap = mmap(NULL, shell->journalCapacity,
+                                 PROT_READ | PROT_WRITE, MAP_SHARED,
+                                 shell->journalFd, 0)) == MAP_FAILED){
+        fprintf(stderr, "smallsh: cannot map journal %s\n", path);
+        exit(1);
+    }
+    shell->journalUsed = 0;
+
+    char header[MAX_INPUT];
+    int len = snprintf(header, sizeof(header), "journal %s\n", scriptPath);
+    memcpy(shell->journalMap, header, len);
+    shell->journalUsed = len;
+}
+
+
+/*
+ * Reopens an existing journal: reloads the script its header names, finds
+ * the last completion record (batch lines complete in order, so everything
+ * up to it is done), and remaps the log to keep appending where the crashed
+ * run stopped. The completed-line count is applied after the preflight pass
+ * builds the line index
+ */
+void journalResume(struct shell* shell, char* path){
+    int fd = open(path, O_RDWR);
+    if(fd == -1){
+        fprintf(stderr, "smallsh: cannot open journal %s\n", path);
+        exit(1);
+    }
+
+    char* log = readAllInput(fd);
+    if(strncmp(log, "journal ", 8) != 0){
+        fprintf(stderr, "smallsh: %s is not a journal\n", path);
+        exit(1);
+    }
+
+    //a crashed run leaves capacity padding past the log; the first NUL is
+    //the real end of what was recorded
+    long used = strlen(log);
+
+    char* headerEnd = strchr(log, '\n');
+    *headerEnd = '\0';
+    loadScriptFile(shell, log + 8);
+
+    //scan the records for the last completed line
+    int lastCompleted = -1;
+    for(char* record = headerEnd + 1; record < log + used;){
+        if(record[0] == '=' && record[1] == ' ')
+            lastCompleted = atoi(record + 2);
+
+        char* recordEnd = strchr(record, '\n');
+        if(recordEnd == NULL)
+            break; //a torn dispatch record from the crash; ignore it
+        record = recordEnd + 1;
+    }
+    shell->journalSkipLines = lastCompleted + 1;
+    free(log);
+
+    shell->journalFd = fd;
+    shell->journalCapacity = JOURNAL_INITIAL_CAPACITY;
+    while(used + 1 > shell->journalCapacity)
+        shell->journalCapacity *= 2;
+
+    if(ftruncate(fd, shell->journalCapacity) == -1 ||
+       (shell->journalMap = mmap(NULL, shell->journalCapacity,
+                                 PROT_READ | PROT_WRITE, MAP_SHARED,
+                                 fd, 0)) == MAP_FAILED){
+        fprintf(stderr, "smallsh: cannot map journal %s\n", path);
+        exit(1);
+    }
+    shell->journalUsed = used;
+}
+
+
+/*
+ * Returns the next executable line out of the preflight index, NULL when the
+ * script has been exhausted. Lines of any length come back whole — nothing
+ * is copied and nothing truncates
+ */
+char* nextScriptLine(struct shell* shell){
+    if(shell->scriptLineNext == shell->scriptLineCount)
+        return NULL;
+
+    return shell->scriptLines[shell->scriptLineNext++];
+}
+
+
+/*
+ * Resets the per-segment command state: argv, redirect targets, chain
+ * bookkeeping, and the background flag. Used between segments of a
+ * ";"/"&&"/"||" command list, where the arena has to stay intact because it
+ * still holds the unparsed rest of the line
+ */
+void commandSegmentReset(struct shell* shell){
+    //clear only the argv entries this command actually used
+    if(shell->cmdLineArgCount > 0)
+        memset(shell->cmdLineArgs, '\0', shell->cmdLineArgCount * sizeof(char*));
+    shell->cmdLineArgCount = 0;
+
+    //reset input/output, the strings themselves live in the arena
+    shell->inputFile = NULL;
+    shell->outputFile = NULL;
+    shell->hereString = NULL;
+    shell->chainRest = NULL;
+
+    //reset bgFlag to 0
+    shell->bgFlag = 0;
+}
+
+
+/*
+ * Resets all of the command line arguments, input/output file names, and resets
+ * background flag in the shell struct that's passed in. This "cleans" the arguments
+ * to prepare for getting more commands from the user. All argument strings live in
+ * the per-command arena, so reclaiming them is a single pointer reset
+ */
+void commandLineArgumentReset(struct shell* shell){
+    commandSegmentReset(shell);
+
+    //reclaim every string carved from the arena this command, dropping any
+    //overflow chunks an oversized command chained on
+    shell->arenaUsed = 0;
+    while(shell->arenaOverflow != NULL){
+        struct arenaChunk* chunk = shell->arenaOverflow;
+        shell->arenaOverflow = chunk->next;
+        free(chunk);
+    }
+
+    //the glob snapshots only live for the cycle too
+    while(shell->dirSnapshotCount > 0){
+        shell->dirSnapshotCount--;
+        free(shell->dirSnapshots[shell->dirSnapshotCount].path);
+        free(shell->dirSnapshots[shell->dirSnapshotCount].names);
+    }
+}
+
+
+/*
+ * Appends one background-completion report to the output batch. The caller
+ * decides when the batch goes out. With notifications rerouted to a
+ * dedicated fd, the report is written straight there instead, so stdout
+ * never sees it
+ */
+void appendJobDoneReport(struct shell* shell, pid_t pid, int status){
+    if(shell->notifyFd != STDOUT_FILENO){
+        char report[128];
+        int len;
+        if(WIFEXITED(status))
+            len = snprintf(report, sizeof(report),
+                           "Background pid %d is done: Exit value %d\n",
+                           pid, WEXITSTATUS(status));
+        else
+            len = snprintf(report, sizeof(report),
+                           "Background pid %d is done: Terminated by signal %d\n",
+                           pid, WTERMSIG(status));
+        write(shell->notifyFd, report, len);
+        return;
+    }
+
+    outputAppendLiteral(shell, "Background pid ");
+    outputAppendInt(shell, pid);
+
+    if(WIFEXITED(status)){
+        outputAppendLiteral(shell, " is done: Exit value ");
+        outputAppendInt(shell, WEXITSTATUS(status));
+    }
+    else{
+        outputAppendLiteral(shell, " is done: Terminated by signal ");
+        outputAppendInt(shell, WTERMSIG(status));
+    }
+
+    outputAppendLiteral(shell, "\n");
+}
+
+
+/*
+ * Folds one reaped child's rusage in to the shell's running totals: user and
+ * system CPU accumulate, maxrss keeps the peak. Every wait site feeds through
+ * here so the stats builtin attributes resources across the whole session
+ */
+void accountChildUsage(struct shell* shell, struct rusage* usage){
+    shell->childUserUs += usage->ru_utime.tv_sec * 1000000L + usage->ru_utime.tv_usec;
+    shell->childSysUs += usage->ru_stime.tv_sec * 1000000L + usage->ru_stime.tv_usec;
+    if(usage->ru_maxrss > shell->childMaxRssKb)
+        shell->childMaxRssKb = usage->ru_maxrss;
+    shell->childrenAccounted++;
+}
+
+
+/*
+ * Appends one child's resource report through the output batcher: user and
+ * system CPU in milliseconds plus peak resident set. Printed after each
+ * foreground command when per-command reporting is switched on
+ */
+void appendUsageReport(struct shell* shell, pid_t pid, struct rusage* usage){
+    outputAppendLiteral(shell, "pid ");
+    outputAppendInt(shell, pid);
+    outputAppendLiteral(shell, ": user ");
+    outputAppendInt(shell, usage->ru_utime.tv_sec * 1000 + usage->ru_utime.tv_usec / 1000);
+    outputAppendLiteral(shell, " ms, sys ");
+    outputAppendInt(shell, usage->ru_stime.tv_sec * 1000 + usage->ru_stime.tv_usec / 1000);
+    outputAppendLiteral(shell, " ms, maxrss ");
+    outputAppendInt(shell, usage->ru_maxrss);
+    outputAppendLiteral(shell, " kB\n");
+    outputFlush(shell);
+}
+
+
+/*
+ * Emits the coalesced one-line notice for a burst of completions when the
+ * summary policy is active. The counters come from whichever drain loop
+ * collected the burst; the line is flushed before returning since it lives
+ * on this call's stack
+ */
+void appendJobSummaryReport(struct shell* shell, int burstDone, int burstFailed){
+    if(shell->notifyMode != NOTIFY_SUMMARY || burstDone == 0)
+        return;
+
+    char summary[96];
+    int len = snprintf(summary, sizeof(summary),
+                       "%d background job(s) done, %d failed\n",
+                       burstDone, burstFailed);
+    if(shell->notifyFd != STDOUT_FILENO){
+        write(shell->notifyFd, summary, len);
+    }
+    else{
+        outputAppend(shell, summary, len);
+        outputFlush(shell);
+    }
+}
+
+
+/*
+ * Renders a deferred foreground-only mode toggle through the batched output
+ * layer. The SIGTSTP handler only flips flags, so this runs from the main
+ * loop at the next safe point; a rapid double-toggle collapses in to one
+ * banner announcing the state the shell actually landed in
+ */
+void reportModeToggle(struct shell* shell){
+    if(!fgFlagPending)
+        return;
+    fgFlagPending = 0;
+
+    if(fgFlag)
+        outputAppendLiteral(shell, "\nEntering foreground-only mode (& is now ignored)\n");
+    else
+        outputAppendLiteral(shell, "\nExiting foreground-only mode\n");
+    outputFlush(shell);
+}
+
+
+/*
+ * Announces a just-launched background job's PID, honoring the notification
+ * policy and destination fd
+ */
+void appendJobStartReport(struct shell* shell, pid_t pid){
+    if(shell->notifyMode == NOTIFY_OFF)
+        return;
+
+    if(shell->notifyFd != STDOUT_FILENO){
+        char report[64];
+        int len = snprintf(report, sizeof(report), "Background PID is %d\n", pid);
+        write(shell->notifyFd, report, len);
+        return;
+    }
+
+    outputAppendLiteral(shell, "Background PID is ");
+    outputAppendInt(shell, pid);
+    outputAppendLiteral(shell, "\n");
+    outputFlush(shell);
+}
+
+
+/*
+ * Adds a command line to the history ring, overwriting the oldest entry once
+ * the ring is full. When persist is set, the line is also appended to the
+ * history file with a single buffered write (persist is 0 while replaying the
+ * file at startup)
+ */
+void historyAdd(struct shell* shell, char* line, int persist){
+    //skip empty lines and immediate repeats of the previous command
+    if(line[0] == '\0')
+        return;
+    if(shell->historyCount > 0 &&
+       strcmp(shell->history[(shell->historyCount - 1) % HISTORY_ENTRIES], line) == 0)
+        return;
+
+    int slot = shell->historyCount % HISTORY_ENTRIES;
+    strncpy(shell->history[slot], line, MAX_INPUT - 1);
+    shell->history[slot][MAX_INPUT - 1] = '\0';
+    shell->historyFirstByte[slot] = line[0];
+    shell->historyParses[slot].valid = 0; //whatever parse lived here is stale
+    shell->historyCount++;
+
+    //one write per command, newline included, never one per keystroke
+    if(persist && shell->historyFd != -1){
+        char appendBuffer[MAX_INPUT + 1];
+        int len = snprintf(appendBuffer, sizeof(appendBuffer), "%s\n", line);
+        write(shell->historyFd, appendBuffer, len);
+    }
+}
+
+
+/*
+ * Returns the offset-th newest history entry (offset 1 is the most recent)
+ */
+char* historyGet(struct shell* shell, int offset){
+    return shell->history[(shell->historyCount - offset) % HISTORY_ENTRIES];
+}
+
+
+/*
+ * Resolves a "!"-recall word to a history ring slot: "!!" is the newest
+ * entry, "!prefix" the newest entry starting with prefix. Candidates are
+ * filtered through the first-byte side array, so non-matching entries cost
+ * one byte compare and no string touch. Returns -1 when nothing matches
+ */
+int historyFindRecall(struct shell* shell, char* word){
+    int available = shell->historyCount < HISTORY_ENTRIES ?
+                    shell->historyCount : HISTORY_ENTRIES;
+
+    if(strcmp(word, "!!") == 0)
+        return available > 0 ? (shell->historyCount - 1) % HISTORY_ENTRIES : -1;
+
+    char* prefix = word + 1;
+    int prefixLen = strlen(prefix);
+
+    //newest first
+    for(int offset = 1; offset <= available; offset++){
+        int slot = (shell->historyCount - offset) % HISTORY_ENTRIES;
+        if(shell->historyFirstByte[slot] == prefix[0] &&
+           strncmp(shell->history[slot], prefix, prefixLen) == 0)
+            return slot;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Restores a cached parse in to the shell's live command state. Every pointer
+ * lands in the cache's packed storage, which stays put until its ring slot is
+ * overwritten, long past this command's lifetime
+ */
+void historyRestoreParse(struct shell* shell, struct historyParse* cache){
+    argvEnsureCapacity(shell, cache->argCount + 1);
+    shell->cmdLineArgCount = cache->argCount;
+    for(int x = 0; x < cache->argCount; x++)
+        shell->cmdLineArgs[x] = cache->argOffsets[x] == -1 ?
+                                NULL : cache->storage + cache->argOffsets[x];
+
+    shell->inputFile = cache->inputFileOffset == -1 ?
+                       NULL : cache->storage + cache->inputFileOffset;
+    shell->outputFile = cache->outputFileOffset == -1 ?
+                        NULL : cache->storage + cache->outputFileOffset;
+    shell->hereString = cache->hereStringOffset == -1 ?
+                        NULL : cache->storage + cache->hereStringOffset;
+
+    shell->bgFlag = cache->bgFlag;
+    shell->numStages = cache->numStages;
+    memcpy(shell->stageStart, cache->stageStart, sizeof(shell->stageStart));
+    shell->stageOverflow = 0;
+}
+
+
+/*
+ * Snapshots the just-finished parse in to the newest history entry's cache,
+ * packing every expanded string in to the entry's storage buffer. A parse too
+ * large for the buffer is simply not cached and re-parses on recall
+ */
+void historyCacheParse(struct shell* shell){
+    if(!shell->interactive || shell->historyCount == 0)
+        return;
+
+    //a chained line only has its first segment parsed at this point, so it
+    //is never cached; recalling it re-parses the whole list. a truncated
+    //pipeline is not cached either — its parse is the rejected mangled one
+    if(shell->chainRest != NULL || shell->stageOverflow)
+        return;
+
+    //a cached parse freezes its expansions, and only "$$" is stable for the
+    //shell's lifetime: lines with $VAR/${VAR} references or glob wildcards
+    //must re-expand on recall ($PWD changes on every cd, globs with the
+    //directory), so their parses are never cached
+    char* raw = shell->history[(shell->historyCount - 1) % HISTORY_ENTRIES];
+    for(char* c = raw; *c != '\0'; c++){
+        if(*c == '*' || *c == '?')
+            return;
+        if(*c == '$'){
+            if(c[1] != '$')
+                return;
+            c++; //step over the second "$" of a stable "$$"
+        }
+    }
+
+    struct historyParse* cache =
+        &shell->historyParses[(shell->historyCount - 1) % HISTORY_ENTRIES];
+    cache->valid = 0;
+
+    //the argv span runs to the NULL terminating the last pipeline stage
+    int argCount = shell->stageStart[shell->numStages - 1];
+    while(shell->cmdLineArgs[argCount] != NULL)
+        argCount++;
+
+    //parses wider than the fixed offset table are simply not cached
+    if(argCount > MAX_ARGS)
+        return;
+
+    int used = 0;
+    for(int x = 0; x < argCount; x++){
+        if(shell->cmdLineArgs[x] == NULL){
+            cache->argOffsets[x] = -1;
+            continue;
+        }
+
+        int len = strlen(shell->cmdLineArgs[x]) + 1;
+        if(used + len > (int)sizeof(cache->storage))
+            return;
+        cache->argOffsets[x] = used;
+        memcpy(cache->storage + used, shell->cmdLineArgs[x], len);
+        used += len;
+    }
+    cache->argCount = argCount;
+
+    cache->inputFileOffset = -1;
+    if(shell->inputFile != NULL){
+        int len = strlen(shell->inputFile) + 1;
+        if(used + len > (int)sizeof(cache->storage))
+            return;
+        cache->inputFileOffset = used;
+        memcpy(cache->storage + used, shell->inputFile, len);
+        used += len;
+    }
+
+    cache->outputFileOffset = -1;
+    if(shell->outputFile != NULL){
+        int len = strlen(shell->outputFile) + 1;
+        if(used + len > (int)sizeof(cache->storage))
+            return;
+        cache->outputFileOffset = used;
+        memcpy(cache->storage + used, shell->outputFile, len);
+        used += len;
+    }
+
+    cache->hereStringOffset = -1;
+    if(shell->hereString != NULL){
+        int len = strlen(shell->hereString) + 1;
+        if(used + len > (int)sizeof(cache->storage))
+            return;
+        cache->hereStringOffset = used;
+        memcpy(cache->storage + used, shell->hereString, len);
+        used += len;
+    }
+
+    cache->bgFlag = shell->bgFlag;
+    cache->numStages = shell->numStages;
+    memcpy(cache->stageStart, shell->stageStart, sizeof(cache->stageStart));
+    cache->valid = 1;
+}
+
+
+/*
+ * Repaints the prompt and the line being edited, then parks the terminal
+ * cursor at the editor's cursor position. One write per keystroke
+ */
+void redrawInputLine(char* line, int len, int cursor){
+    char paintBuffer[MAX_INPUT + 32];
+    int n = 0;
+
+    //carriage return, prompt, the line, then clear anything stale after it
+    paintBuffer[n++] = '\r';
+    paintBuffer[n++] = ':';
+    paintBuffer[n++] = ' ';
+    memcpy(paintBuffer + n, line, len);
+    n += len;
+    memcpy(paintBuffer + n, "\x1b[K", 3);
+    n += 3;
+
+    //park the cursor: back to column 0, then forward past the prompt
+    n += sprintf(paintBuffer + n, "\r\x1b[%dC", cursor + 2);
+
+    write(STDOUT_FILENO, paintBuffer, n);
+}
+
+
+/*
+ * Raw-mode interactive line editor: cursor movement (left/right/home/end),
+ * in-place editing (backspace, delete, ^U), and up/down history recall out of
+ * the ring buffer. Returns 0 on end of input (^D on an empty line), otherwise
+ * fills lineOut fgets-style with a trailing newline. Falls back to plain
+ * fgets if the terminal refuses raw mode
+ */
+int readLineInteractive(struct shell* shell, char* lineOut){
+    struct termios original, raw;
+
+    //no tty control means no editor: plain fgets still works
+    if(tcgetattr(STDIN_FILENO, &original) == -1){
+        printf(": ");
+        fflush(stdout);
+        return fgets(lineOut, MAX_INPUT, stdin) != NULL;
+    }
+
+    //raw-ish mode: no echo, no line buffering, but keep ISIG so ^C and ^Z
+    //still reach the shell's signal handlers
+    raw = original;
+    raw.c_lflag &= ~(ECHO | ICANON);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    char line[MAX_INPUT];
+    int len = 0;
+    int cursor = 0;
+    int histOffset = 0; //0 = the new line being typed, n = n-th newest entry
+    int endOfInput = 0;
+
+    redrawInputLine(line, len, cursor);
+
+    while(1){
+        char key;
+        if(read(STDIN_FILENO, &key, 1) != 1){
+            if(errno == EINTR){
+                //a ^Z landed mid-edit: print the deferred mode banner, then
+                //repaint the line under it
+                if(fgFlagPending){
+                    reportModeToggle(shell);
+                    redrawInputLine(line, len, cursor);
+                }
+                continue;
+            }
+            endOfInput = 1;
+            break;
+        }
+
+        if(key == '\r' || key == '\n')
+            break;
+
+        //backspace: delete the character before the cursor
+        else if(key == 127 || key == 8){
+            if(cursor > 0){
+                memmove(line + cursor - 1, line + cursor, len - cursor);
+                cursor--;
+                len--;
+            }
+        }
+
+        //^U kills the whole line, ^A and ^E jump to the ends
+        else if(key == 21){
+            len = 0;
+            cursor = 0;
+        }
+        else if(key == 1)
+            cursor = 0;
+        else if(key == 5)
+            cursor = len;
+
+        //^D on an empty line ends the session
+        else if(key == 4){
+            if(len == 0){
+                endOfInput = 1;
+                break;
+            }
+        }
+
+        //escape sequences: arrows and the delete key
+        else if(key == 27){
+            char seq[2];
+            if(read(STDIN_FILENO, &seq[0], 1) != 1 || read(STDIN_FILENO, &seq[1], 1) != 1)
+                continue;
+            if(seq[0] != '[')
+                continue;
+
+            if(seq[1] == 'D' && cursor > 0)
+                cursor--;
+            else if(seq[1] == 'C' && cursor < len)
+                cursor++;
+
+            //up/down walk the history ring
+            else if(seq[1] == 'A'){
+                int available = shell->historyCount < HISTORY_ENTRIES ?
+                                shell->historyCount : HISTORY_ENTRIES;
+                if(histOffset < available){
+                    histOffset++;
+                    strcpy(line, historyGet(shell, histOffset));
+                    len = strlen(line);
+                    cursor = len;
+                }
+            }
+            else if(seq[1] == 'B'){
+                if(histOffset > 0){
+                    histOffset--;
+                    if(histOffset == 0)
+                        line[0] = '\0';
+                    else
+                        strcpy(line, historyGet(shell, histOffset));
+                    len = strlen(line);
+                    cursor = len;
+                }
+            }
+
+            //delete key arrives as ESC [ 3 ~
+            else if(seq[1] == '3'){
+                char tilde;
+                if(read(STDIN_FILENO, &tilde, 1) == 1 && tilde == '~' && cursor < len){
+                    memmove(line + cursor, line + cursor + 1, len - cursor - 1);
+                    len--;
+                }
+            }
+        }
+
+        //printable characters insert at the cursor
+        else if(key >= 32 && len < MAX_INPUT - 2){
+            memmove(line + cursor + 1, line + cursor, len - cursor);
+            line[cursor] = key;
+            cursor++;
+            len++;
+        }
+
+        redrawInputLine(line, len, cursor);
+    }
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &original);
+    write(STDOUT_FILENO, "\n", 1);
+
+    if(endOfInput)
+        return 0;
+
+    line[len] = '\0';
+
+    //"!" recall lines are added after they resolve, as the command they ran
+    if(line[0] != '!')
+        historyAdd(shell, line, 1);
+
+    //hand the line back fgets-style, trailing newline included
+    memcpy(lineOut, line, len);
+    lineOut[len] = '\n';
+    lineOut[len + 1] = '\0';
+    return 1;
+}
+
+
+//defined after createNewProcess, which it needs to launch deferred jobs
+void launchQueuedJobs(struct shell* shell);
+
+
+/*
+ * Drains the background processes the SIGCHLD handler has already reaped in to
+ * the reap ring, printing the exit status of each and removing its PID from the
+ * job table, then launches any queued background jobs the freed slots allow.
+ * Costs O(completed) work instead of a waitpid syscall per tracked process:
+ * if nothing exited since last prompt, this does no syscalls at all
+ */
+void checkBackgroundProcessTermination(struct shell* shell){
+    int burstDone = 0;
+    int burstFailed = 0;
+
+    //drain whatever the SIGCHLD handler collected since the last prompt
+    while(reapRingTail != reapRingHead){
+        pid_t childPID = reapRing[reapRingTail].pid;
+        int childStatus = reapRing[reapRingTail].status;
+        accountChildUsage(shell, &reapRing[reapRingTail].usage);
+        reapRingTail = (reapRingTail + 1) % REAP_RING_SIZE;
+
+        //remove the pid from the job table, O(1). pids it never tracked
+        //(worker-pool children) get no completion report
+        int tracked = jobTableRemove(&shell->jobs, childPID);
+        if(!tracked)
+            continue;
+
+        burstDone++;
+        if(!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0)
+            burstFailed++;
+
+        //per-job reports only in the verbose policy
+        if(shell->notifyMode == NOTIFY_EACH)
+            appendJobDoneReport(shell, childPID, childStatus);
+    }
+
+    //the coalesced policy folds the whole burst in to one line
+    appendJobSummaryReport(shell, burstDone, burstFailed);
+
+    //the whole burst of reports goes out in one syscall
+    outputFlush(shell);
+
+    //fill whatever slots just opened up from the deferred-job queue
+    launchQueuedJobs(shell);
+}
+
+
+/*
+ * Parses one "$..." reference starting at in (which points at the "$") and
+ * stores the replacement text and its length. Recognizes "$$" (the shell pid),
+ * "$VAR", and "${VAR}"; a "$" that starts no recognized form replaces with
+ * itself. Returns the number of input characters consumed
+ */
+int expandReference(struct shell* shell, char* in, char** text, int* textLen){
+    //"$$": splice in the pid string, rendered on first use
+    if(in[1] == '$'){
+        if(shell->pidStringLen == 0)
+            shell->pidStringLen = sprintf(shell->pidString, "%d", shell->pid);
+        *text = shell->pidString;
+        *textLen = shell->pidStringLen;
+        return 2;
+    }
+
+    //"${VAR}": the name runs to the closing brace
+    if(in[1] == '{'){
+        char* end = strchr(in + 2, '}');
+        if(end != NULL){
+            int nameLen = end - (in + 2);
+            if(nameLen > 0 && nameLen < VAR_NAME_MAX){
+                struct varCacheEntry* entry = varCacheLookup(&shell->vars, in + 2, nameLen);
+                *text = entry->value;
+                *textLen = entry->valueLen;
+                return nameLen + 3;
+            }
+        }
+    }
+
+    //"$VAR": the name is a letter or underscore followed by name characters
+    else if((in[1] >= 'A' && in[1] <= 'Z') || (in[1] >= 'a' && in[1] <= 'z') || in[1] == '_'){
+        int nameLen = 1;
+        while(nameLen < VAR_NAME_MAX){
+            char c = in[1 + nameLen];
+            if((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+               (c >= '0' && c <= '9') || c == '_')
+                nameLen++;
+            else
+                break;
+        }
+
+        struct varCacheEntry* entry = varCacheLookup(&shell->vars, in + 1, nameLen);
+        *text = entry->value;
+        *textLen = entry->valueLen;
+        return nameLen + 1;
+    }
+
+    //a lone "$" stays literal
+    *text = in;
+    *textLen = 1;
+    return 1;
+}
+
+
+/*
+ * Expands "$$", "$VAR", and "${VAR}" references in a token, with variables
+ * resolved through the interned variable cache. Tokens without a "$" are
+ * returned as-is (zero copy, they stay sliced in to the line buffer); tokens
+ * with one are rebuilt in the arena by two forward scans: the first measures
+ * the exact output length, the second splices, and every lookup the second
+ * scan makes is a cache hit from the first. O(output length)
+ */
+char* expandToken(struct shell* shell, char* token){
+    if(strchr(token, '$') == NULL)
+        return token;
+
+    char* text;
+    int textLen;
+
+    //first pass: measure the output
+    int outLen = 0;
+    char* in = token;
+    while(*in != '\0'){
+        if(*in == '$'){
+            in += expandReference(shell, in, &text, &textLen);
+            outLen += textLen;
+        }
+        else{
+            in++;
+            outLen++;
+        }
+    }
+
+    char* expanded = arenaAlloc(shell, outLen + 1);
+
+    //second pass: splice
+    in = token;
+    char* out = expanded;
+    while(*in != '\0'){
+        if(*in == '$'){
+            in += expandReference(shell, in, &text, &textLen);
+            memcpy(out, text, textLen);
+            out += textLen;
+        }
+        else{
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+
+    return expanded;
+}
+
+
+/*
+ * Matches a name against a glob pattern supporting "*" (any run of
+ * characters) and "?" (any one character). Iterative with one backtrack
+ * point, so even adversarial patterns stay cheap
+ */
+int globMatch(char* pattern, char* name){
+    char* p = pattern;
+    char* n = name;
+    char* starP = NULL;
+    char* starN = NULL;
+
+    while(*n != '\0'){
+        if(*p == '*'){
+            starP = p++;
+            starN = n;
+        }
+        else if(*p == '?' || *p == *n){
+            p++;
+            n++;
+        }
+        else if(starP != NULL){
+            //the last "*" swallows one more character and matching retries
+            p = starP + 1;
+            n = ++starN;
+        }
+        else{
+            return 0;
+        }
+    }
+
+    while(*p == '*')
+        p++;
+    return *p == '\0';
+}
+
+
+/*
+ * Returns the snapshot of a directory's entry names, reading the directory
+ * only on the first request of the command cycle: later patterns aimed at
+ * the same directory reuse it. Names pack back to back in the snapshot's
+ * own buffer, doubled on demand, so directories of any size fit. Returns
+ * NULL when the directory cannot be read (the caller falls back to the
+ * literal argument)
+ */
+struct dirSnapshot* getDirSnapshot(struct shell* shell, char* path){
+    for(int x = 0; x < shell->dirSnapshotCount; x++){
+        if(strcmp(shell->dirSnapshots[x].path, path) == 0)
+            return &shell->dirSnapshots[x];
+    }
+
+    DIR* dir = opendir(path);
+    if(dir == NULL)
+        return NULL;
+
+    //overwrite the last slot if more directories appear in one command
+    //cycle than the cache holds
+    int slot = shell->dirSnapshotCount < GLOB_CACHE_DIRS ?
+               shell->dirSnapshotCount : GLOB_CACHE_DIRS - 1;
+    struct dirSnapshot* snap = &shell->dirSnapshots[slot];
+    if(slot < shell->dirSnapshotCount){
+        free(snap->path);
+        free(snap->names);
+    }
+
+    snap->path = strdup(path);
+    snap->count = 0;
+
+    int capacity = 4096;
+    int used = 0;
+    snap->names = malloc(capacity);
+
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL){
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        int len = strlen(entry->d_name);
+        if(used + len + 1 > capacity){
+            capacity *= 2;
+            snap->names = realloc(snap->names, capacity);
+        }
+        memcpy(snap->names + used, entry->d_name, len + 1);
+        used += len + 1;
+        snap->count++;
+    }
+    closedir(dir);
+
+    if(slot == shell->dirSnapshotCount)
+        shell->dirSnapshotCount++;
+    return snap;
+}
+
+
+//qsort comparator for the argv entries a glob expansion appends
+int compareGlobMatches(const void* a, const void* b){
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+
+/*
+ * Expands "*"/"?" wildcards in an argument against its directory's snapshot,
+ * appending each match (directory prefix included, sorted) to argv and
+ * returning the new argv count. Wildcards only expand in the final path
+ * component; arguments without wildcards, patterns whose directory part has
+ * wildcards of its own, unreadable directories, and patterns matching
+ * nothing all append the argument as typed. Matches are carved from the
+ * arena like every other argument string
+ */
+int globExpand(struct shell* shell, char* arg, int cmdNumber){
+    if(strpbrk(arg, "*?") == NULL){
+        shell->cmdLineArgs[cmdNumber++] = arg;
+        return cmdNumber;
+    }
+
+    //split off the directory part ahead of the last "/"
+    char* lastSlash = strrchr(arg, '/');
+    char* dirPath = ".";
+    char* pattern = arg;
+    int prefixLen = 0;
+
+    if(lastSlash != NULL){
+        pattern = lastSlash + 1;
+        prefixLen = lastSlash - arg + 1;
+
+        //a wildcard in the directory part stays literal
+        if(memchr(arg, '*', prefixLen) != NULL ||
+           memchr(arg, '?', prefixLen) != NULL){
+            shell->cmdLineArgs[cmdNumber++] = arg;
+            return cmdNumber;
+        }
+
+        dirPath = arenaAlloc(shell, prefixLen + 1);
+        memcpy(dirPath, arg, prefixLen);
+        dirPath[prefixLen] = '\0';
+    }
+
+    struct dirSnapshot* snap = getDirSnapshot(shell, dirPath);
+    if(snap == NULL){
+        shell->cmdLineArgs[cmdNumber++] = arg;
+        return cmdNumber;
+    }
+
+    //hidden names only match patterns that ask for them explicitly
+    int first = cmdNumber;
+    char* name = snap->names;
+    for(int x = 0; x < snap->count; x++){
+        int len = strlen(name);
+        if((name[0] != '.' || pattern[0] == '.') && globMatch(pattern, name)){
+            char* match = arenaAlloc(shell, prefixLen + len + 1);
+            memcpy(match, arg, prefixLen);
+            memcpy(match + prefixLen, name, len + 1);
+            argvEnsureCapacity(shell, cmdNumber + 2);
+            shell->cmdLineArgs[cmdNumber++] = match;
+        }
+        name += len + 1;
+    }
+
+    //no matches: the pattern stands as typed
+    if(cmdNumber == first){
+        shell->cmdLineArgs[cmdNumber++] = arg;
+        return cmdNumber;
+    }
+
+    //snapshots are in directory order; commands expect sorted arguments
+    qsort(&shell->cmdLineArgs[first], cmdNumber - first, sizeof(char*),
+          compareGlobMatches);
+    return cmdNumber;
+}
+
+
+/*
+ * Tokenizes one command segment out of a line already sitting in the arena,
+ * in a single pass that writes NUL terminators directly in to the line and
+ * builds argv as pointers in to it while classifying "<", ">", "<<<", "|",
+ * and trailing "&" operators as it goes. "$"-references are expanded per
+ * token, copying only tokens that actually contain one. A ";", "&&", or "||"
+ * ends the segment: the unparsed rest of the line is left in chainRest for
+ * the main loop to run (or skip) once this segment's exit status is known
+ */
+void parseCommandSegment(struct shell* shell, char* line){
+    //time the tokenize/expand work, not the wait for input around it
+    long parseStart = monotonicNs();
+
+    //the segment starts out as a single pipeline stage. entry 0 has to be
+    //readable even when the segment turns out empty
+    argvEnsureCapacity(shell, 1);
+    shell->numStages = 1;
+    shell->stageStart[0] = 0;
+    shell->stageOverflow = 0;
+
+    //single-pass tokenize-and-classify state
+    int cmdNumber = 0;
+    char* cursor = line;
+    int expectInputFile = 0; //previous token was "<"
+    int expectOutputFile = 0; //previous token was ">"
+    int expectHereString = 0; //previous token was "<<<"
+    int sawRedirect = 0; //arguments after a redirect never reach execvp
+    char* pendingAmp = NULL; //"&" seen, only special if the segment ends here
+
+    while(*cursor != '\0'){
+        //skip runs of spaces between tokens
+        while(*cursor == ' ')
+            cursor++;
+        if(*cursor == '\0')
+            break;
+
+        //slice the token out of the line by dropping a NUL at its end
+        char* token = cursor;
+        while(*cursor != ' ' && *cursor != '\0')
+            cursor++;
+        if(*cursor == ' ')
+            *cursor++ = '\0';
+
+        //a "&" that wasn't the last token is just an ordinary argument
+        if(pendingAmp != NULL){
+            if(!sawRedirect){
+                argvEnsureCapacity(shell, cmdNumber + 2);
+                shell->cmdLineArgs[cmdNumber++] = pendingAmp;
+            }
+            pendingAmp = NULL;
+        }
+
+        //this token is the filename for a pending redirect
+        if(expectInputFile){
+            shell->inputFile = expandToken(shell, token);
+            expectInputFile = 0;
+        }
+        else if(expectOutputFile){
+            shell->outputFile = expandToken(shell, token);
+            expectOutputFile = 0;
+        }
+        else if(expectHereString){
+            shell->hereString = expandToken(shell, token);
+            expectHereString = 0;
+        }
+
+        //here-string operator: the next token is an in-memory stdin payload.
+        //checked before "<" since both start the same way
+        else if(strcmp(token, "<<<") == 0){
+            expectHereString = 1;
+            sawRedirect = 1;
+        }
+
+        //redirect operators: remember the next token is a filename
+        else if(strcmp(token, "<") == 0){
+            expectInputFile = 1;
+            sawRedirect = 1;
+        }
+        else if(strcmp(token, ">") == 0){
+            expectOutputFile = 1;
+            sawRedirect = 1;
+        }
+
+        //"|" ends the current stage's argv (the untouched NULL entry at
+        //cmdNumber terminates it) and starts the next stage after it
+        else if(strcmp(token, "|") == 0){
+            if(shell->numStages < MAX_PIPELINE_STAGES){
+                argvEnsureCapacity(shell, cmdNumber + 2);
+                cmdNumber++;
+                shell->stageStart[shell->numStages++] = cmdNumber;
+                sawRedirect = 0;
+            }
+            //a "|" past the stage limit can't be honored: flag it so the
+            //launch rejects the pipeline instead of running a mangled one
+            else{
+                shell->stageOverflow = 1;
+            }
+        }
+
+        //chain operators end this segment: the rest of the line waits in
+        //chainRest until this segment's exit status decides its fate
+        else if(strcmp(token, ";") == 0 || strcmp(token, "&&") == 0 ||
+                strcmp(token, "||") == 0){
+            shell->chainOp = token[0] == ';' ? CHAIN_ALWAYS :
+                             token[0] == '&' ? CHAIN_AND : CHAIN_OR;
+            shell->chainRest = cursor;
+            break;
+        }
+
+        //"&" only means background if it turns out to be the last token
+        else if(strcmp(token, "&") == 0){
+            pendingAmp = token;
+        }
+
+        //ordinary argument, kept only if no redirect has started yet.
+        //"$" expansion first, then any wildcards expand against the
+        //directory snapshots
+        else if(!sawRedirect){
+            argvEnsureCapacity(shell, cmdNumber + 2);
+            cmdNumber = globExpand(shell, expandToken(shell, token), cmdNumber);
+        }
+    }
+
+    //a trailing "&" means run in the background
+    if(pendingAmp != NULL)
+        shell->bgFlag = 1;
+
+    //how many argv entries reset will have to clear
+    shell->cmdLineArgCount = cmdNumber;
+
+    histogramRecord(&shell->parseHist, monotonicNs() - parseStart);
+}
+
+
+/*
+ * Gets command line arguments from the user. Does not error handle correct command line
+ * syntax. Batch lines are sliced straight out of the script buffer at any
+ * length; interactive lines come from the fixed-size editor buffer and move
+ * in to the arena so the argv slices outlive this call's stack
+ */
+void getCommandLineArguments(struct shell* shell){
+    int invalidInput = 1;
+    char editorInput[MAX_INPUT];
+    char* line = NULL;
+
+    //loop until the user provides one or more valid commands
+    while(invalidInput){
+        checkBackgroundProcessTermination(shell);
+
+        if(shell->scriptBuffer != NULL){
+            //batch mode: the preflight index already dropped comments and
+            //blanks, so every line here is executable. running out means exit
+            line = nextScriptLine(shell);
+            if(line == NULL){
+                shell->exitShell = 1;
+                return;
+            }
+            invalidInput = 0;
+
+            //journal the line before tokenization slices it apart
+            if(shell->journalMap != NULL)
+                journalRecordDispatch(shell, shell->scriptLineNext - 1, line);
+        }
+        else{
+            //interactive: raw-mode line editor with history. end of input
+            //(^D on an empty line) means exit
+            if(!readLineInteractive(shell, editorInput)){
+                shell->exitShell = 1;
+                return;
+            }
+            editorInput[strcspn(editorInput, "\n")] = '\0';
+            line = editorInput;
+
+            //check for comments/empty input
+            if(line[0] != '\0' && line[0] != '#')
+                invalidInput = 0;
+        }
+
+        //history recall: "!!" reruns the previous command, "!prefix" the
+        //newest command starting with prefix. an entry with a cached parse
+        //restores the whole command state and skips tokenization entirely
+        if(!invalidInput && shell->interactive && line[0] == '!'){
+            int slot = historyFindRecall(shell, line);
+            if(slot == -1){
+                fprintf(stderr, "smallsh: %s: event not found\n", line);
+                invalidInput = 1;
+                continue;
+            }
+
+            //echo the command being rerun, then record it like a typed line
+            strcpy(editorInput, shell->history[slot]);
+            outputAppend(shell, editorInput, strlen(editorInput));
+            outputAppendLiteral(shell, "\n");
+            outputFlush(shell);
+
+            if(shell->historyParses[slot].valid){
+                historyRestoreParse(shell, &shell->historyParses[slot]);
+                historyAdd(shell, editorInput, 1);
+                return;
+            }
+
+            //no cached parse: the recalled line tokenizes normally below
+            historyAdd(shell, editorInput, 1);
+        }
+    }
+
+    //---separate input in to individual arguments
+
+    //interactive lines move in to the arena; batch lines already sit in the
+    //stable script buffer and parse where they are
+    if(line == editorInput){
+        char* copy = arenaAlloc(shell, strlen(line) + 1);
+        strcpy(copy, line);
+        line = copy;
+    }
+    parseCommandSegment(shell, line);
+
+    //remember this parse alongside its history entry for "!" recall
+    historyCacheParse(shell);
+}
+
+
+/*
+ * Custom handler for SIGTSTP. Enters foreground-only mode if not already in it, otherwise
+ * exits forground-only mode. Only flips the flags — a blocking write here
+ * could stall on a full pipe while a foreground child is being waited on, so
+ * the banner is rendered by the main loop at the next safe point instead
+ */
+void handle_SIGTSTP(int signo){
+    fgFlag = !fgFlag;
+    fgFlagPending = 1;
+}
+
+
+/*
+ * Kills any running child processes and sets variable to exit the shell in main loop
+ */
+void exitSmallShell(struct shell* shell){
+    //kill any running child processes still in the job table
+    for(int x = 0; x < shell->jobs.capacity; x++){
+        if(shell->jobs.pids[x] != JOB_SLOT_EMPTY && shell->jobs.pids[x] != JOB_SLOT_REMOVED)
+            kill(shell->jobs.pids[x], SIGKILL);
+    }
+    //set variable to terminate while loop
+    shell->exitShell = 1;
+}
+
+
+/*
+ * Prints the exit status of either the most recently ran foreground process, or the 
+ * current exit status of the shell if no foreground processes have been run
+ */
+void printShellStatus(struct shell* shell){
+    //if exitStatus is 0, that means last exit was normal
+    if(shell->exitStatus == 0){
+        outputAppendLiteral(shell, "exit value 0\n");
+    }
+
+    //if last exit wasn't 0, check if last child exited normally or abnormally
+    else if(WIFEXITED(shell->exitStatus)){
+        //child terminated normally
+        outputAppendLiteral(shell, "exit value ");
+        outputAppendInt(shell, WEXITSTATUS(shell->exitStatus));
+        outputAppendLiteral(shell, "\n");
+    }
+    else{
+        //child terminated abnormally
+        outputAppendLiteral(shell, "terminated by signal ");
+        outputAppendInt(shell, WTERMSIG(shell->exitStatus));
+        outputAppendLiteral(shell, "\n");
+    }
+
+    outputFlush(shell);
+}
+
+
+/*
+ * Prints one phase's latency histogram: sample count, average, and every
+ * populated log2 bucket
+ */
+void printHistogram(char* name, struct latencyHistogram* hist){
+    if(hist->count == 0){
+        printf("%s: no samples\n", name);
+        return;
+    }
+
+    printf("%s: %ld samples, avg %ld ns\n", name, hist->count, hist->totalNs / hist->count);
+    for(int x = 0; x < HISTOGRAM_BUCKETS; x++){
+        if(hist->buckets[x] != 0)
+            printf("  < %ld ns: %ld\n", 2L << x, hist->buckets[x]);
+    }
+}
+
+
+/*
+ * The stats builtin: dumps the parse/spawn/wait latency histograms and the
+ * child resource totals the wait sites have been accumulating since startup.
+ * "stats usage on|off" toggles the per-command resource report line
+ */
+void printShellStats(struct shell* shell){
+    if(shell->cmdLineArgs[1] != NULL && strcmp(shell->cmdLineArgs[1], "usage") == 0){
+        if(shell->cmdLineArgs[2] != NULL && strcmp(shell->cmdLineArgs[2], "on") == 0)
+            shell->rusageReport = 1;
+        else if(shell->cmdLineArgs[2] != NULL && strcmp(shell->cmdLineArgs[2], "off") == 0)
+            shell->rusageReport = 0;
+        else
+            fprintf(stderr, "smallsh: usage: stats usage on|off\n");
+        return;
+    }
+
+    printHistogram("parse", &shell->parseHist);
+    printHistogram("spawn", &shell->spawnHist);
+    printHistogram("wait", &shell->waitHist);
+
+    if(shell->childrenAccounted > 0)
+        printf("children: %ld reaped, user %ld.%03lds, sys %ld.%03lds, peak maxrss %ld kB\n",
+               shell->childrenAccounted,
+               shell->childUserUs / 1000000, shell->childUserUs / 1000 % 1000,
+               shell->childSysUs / 1000000, shell->childSysUs / 1000 % 1000,
+               shell->childMaxRssKb);
+    fflush(stdout);
+}
+
+
+/*
+ * Seeds the logical cwd cache on first use: trust $PWD when the environment
+ * provides an absolute one, otherwise pay getcwd exactly once per session
+ */
+void seedCwdCache(struct shell* shell){
+    if(shell->cwd[0] != '\0')
+        return;
+
+    char* envPwd = getenv("PWD");
+    if(envPwd != NULL && envPwd[0] == '/' && strlen(envPwd) < MAX_INPUT)
+        strcpy(shell->cwd, envPwd);
+    else if(getcwd(shell->cwd, MAX_INPUT) == NULL)
+        strcpy(shell->cwd, "/");
+}
+
+
+/*
+ * Applies one cd target to the cached logical working directory: absolute
+ * paths replace it outright, relative ones are folded in one component at a
+ * time with "." dropped and ".." popping the previous component. The result
+ * goes in to both the environment and the expansion cache, so $PWD stays
+ * correct without a getcwd syscall anywhere
+ */
+void updateCwdCache(struct shell* shell, char* path){
+    char updated[MAX_INPUT];
+    int len;
+
+    if(path[0] == '/'){
+        len = 0;
+    }
+    else{
+        len = strlen(shell->cwd);
+        memcpy(updated, shell->cwd, len);
+
+        //the root directory contributes no component of its own
+        if(len == 1 && updated[0] == '/')
+            len = 0;
+    }
+
+    //fold the target in component by component
+    char* component = path;
+    while(*component != '\0'){
+        while(*component == '/')
+            component++;
+        if(*component == '\0')
+            break;
+
+        int compLen = 0;
+        while(component[compLen] != '\0' && component[compLen] != '/')
+            compLen++;
+
+        if(compLen == 1 && component[0] == '.'){
+            //"." leaves the path alone
+        }
+        else if(compLen == 2 && component[0] == '.' && component[1] == '.'){
+            //".." pops the previous component, stopping at the root
+            while(len > 0 && updated[len - 1] != '/')
+                len--;
+            if(len > 0)
+                len--;
+        }
+        else if(len + 1 + compLen < MAX_INPUT){
+            updated[len++] = '/';
+            memcpy(updated + len, component, compLen);
+            len += compLen;
+        }
+
+        component += compLen;
+    }
+
+    //everything popped away means the root
+    if(len == 0)
+        updated[len++] = '/';
+    updated[len] = '\0';
+
+    strcpy(shell->cwd, updated);
+    setenv("PWD", shell->cwd, 1);
+    varCacheStore(&shell->vars, "PWD", shell->cwd);
+}
+
+
+/*
+ * Moves the shell to the given directory, remembering where it came from:
+ * the directory being left is held open as an O_PATH fd so "cd -" returns
+ * with a single fchdir instead of a fresh path walk. Returns 0 on success
+ */
+int applyDirectoryChange(struct shell* shell, char* target){
+    seedCwdCache(shell);
+
+    //hold the current directory open before leaving it; O_PATH needs no
+    //read permission and the fd pins the directory for a later fchdir
+    int hereFd = open(".", O_PATH | O_CLOEXEC);
+
+    if(chdir(target) == -1){
+        fprintf(stderr, "smallsh: cd: %s: %s\n", target, strerror(errno));
+        if(hereFd != -1)
+            close(hereFd);
+        return -1;
+    }
+
+    if(shell->prevDirFd != -1)
+        close(shell->prevDirFd);
+    shell->prevDirFd = hereFd;
+    strcpy(shell->prevDir, shell->cwd);
+
+    updateCwdCache(shell, target);
+
+    //cached paths resolved through relative PATH directories are stale now
+    pathCacheFlush(&shell->paths, 1);
+    return 0;
+}
+
+
+/*
+ * Changes the directory of the shell based on user input. If no path was given, changes
+ * directory to home directory. "cd -" returns to the previous directory
+ * through its held O_PATH fd — one fchdir, no path resolution at all
+ */
+void changeShellDirectory(struct shell* shell){
+    char* target = shell->cmdLineArgs[1];
+
+    //no path means the home directory
+    if(target == NULL){
+        target = getenv("HOME");
+        if(target == NULL)
+            return;
+    }
+
+    else if(strcmp(target, "-") == 0){
+        if(shell->prevDirFd == -1){
+            fprintf(stderr, "smallsh: cd: no previous directory\n");
+            return;
+        }
+
+        int hereFd = open(".", O_PATH | O_CLOEXEC);
+        if(fchdir(shell->prevDirFd) == -1){
+            fprintf(stderr, "smallsh: cd: %s: %s\n", shell->prevDir, strerror(errno));
+            if(hereFd != -1)
+                close(hereFd);
+            return;
+        }
+
+        //swap current and previous: the fd we just used is spent, the one
+        //just opened backs the next "cd -"
+        close(shell->prevDirFd);
+        shell->prevDirFd = hereFd;
+
+        char swap[MAX_INPUT];
+        strcpy(swap, shell->cwd);
+        strcpy(shell->cwd, shell->prevDir);
+        strcpy(shell->prevDir, swap);
+
+        setenv("PWD", shell->cwd, 1);
+        varCacheStore(&shell->vars, "PWD", shell->cwd);
+        pathCacheFlush(&shell->paths, 1);
+
+        printf("%s\n", shell->cwd);
+        fflush(stdout);
+        return;
+    }
+
+    applyDirectoryChange(shell, target);
+}
+
+
+/*
+ * The pushd builtin: saves the current directory on the stack as an O_PATH
+ * fd plus its logical path, then moves to the given one. Revisiting deep
+ * directories thousands of times per run this way costs one fchdir each
+ * instead of a full per-component resolution
+ */
+void pushShellDirectory(struct shell* shell){
+    if(shell->cmdLineArgs[1] == NULL){
+        fprintf(stderr, "smallsh: usage: pushd <dir>\n");
+        return;
+    }
+    if(shell->dirStackCount >= DIR_STACK_MAX){
+        fprintf(stderr, "smallsh: pushd: directory stack full\n");
+        return;
+    }
+
+    seedCwdCache(shell);
+    char saved[MAX_INPUT];
+    strcpy(saved, shell->cwd);
+
+    int hereFd = open(".", O_PATH | O_CLOEXEC);
+    if(hereFd == -1){
+        perror("smallsh: pushd");
+        return;
+    }
+
+    if(applyDirectoryChange(shell, shell->cmdLineArgs[1]) == -1){
+        close(hereFd);
+        return;
+    }
+
+    shell->dirStackFds[shell->dirStackCount] = hereFd;
+    shell->dirStackPaths[shell->dirStackCount] = strdup(saved);
+    shell->dirStackCount++;
+}
+
+
+/*
+ * The popd builtin: returns to the directory on top of the stack through
+ * its held O_PATH fd. The entry is consumed whether or not the fchdir
+ * succeeds (a failure means the directory is gone)
  */
-struct shell* shellSetUp(){
-    struct shell* shell = calloc(1, sizeof(struct shell));//malloc(sizeof(struct shell));
-    shell->pid = getpid();
-    shell->childPID = -5;
-    shell->exitShell = 0;
-    shell->exitStatus = 0;
-    shell->bgFlag = 0;
-    
-    //bgProcesses will keep track of bgProcesses that haven't terminated yet
-    memset(shell->bgProcesses, 0, 50);
+void popShellDirectory(struct shell* shell){
+    if(shell->dirStackCount == 0){
+        fprintf(stderr, "smallsh: popd: directory stack empty\n");
+        return;
+    }
 
-    //cmdLineArgs is an array of all arguments user put in
-    memset(shell->cmdLineArgs, '\0', MAX_ARGS);
+    int top = --shell->dirStackCount;
+    int hereFd = open(".", O_PATH | O_CLOEXEC);
 
-    //if input/output processes are requested, these will keep track of the files
-    //to input/output to
-    shell->inputFile = NULL;
-    shell->outputFile = NULL;
+    if(fchdir(shell->dirStackFds[top]) == -1){
+        fprintf(stderr, "smallsh: popd: %s: %s\n",
+                shell->dirStackPaths[top], strerror(errno));
+        if(hereFd != -1)
+            close(hereFd);
+    }
+    else{
+        if(shell->prevDirFd != -1)
+            close(shell->prevDirFd);
+        shell->prevDirFd = hereFd;
+        strcpy(shell->prevDir, shell->cwd);
+
+        strcpy(shell->cwd, shell->dirStackPaths[top]);
+        setenv("PWD", shell->cwd, 1);
+        varCacheStore(&shell->vars, "PWD", shell->cwd);
+        pathCacheFlush(&shell->paths, 1);
+    }
 
-    return shell;
+    close(shell->dirStackFds[top]);
+    free(shell->dirStackPaths[top]);
 }
 
 
 /*
- * Resets all of the command line arguments, input/output file names, and resets
- * background flag in the shell struct that's passed in. This "cleans" the arguments
- * to prepare for getting more commands from the user
+ * The hash builtin, modeled on bash's: "hash -r" empties the command path
+ * cache (needed after installing a new binary earlier on PATH), plain "hash"
+ * lists what has been cached so far
  */
-void commandLineArgumentReset(struct shell* shell){
-    //free memory used by arguments
-    for(int x = 0; x < MAX_ARGS; x++){
-        if(shell->cmdLineArgs[x] != '\0')
-            free(shell->cmdLineArgs[x]);
+void managePathCache(struct shell* shell){
+    if(shell->cmdLineArgs[1] != NULL && strcmp(shell->cmdLineArgs[1], "-r") == 0){
+        pathCacheFlush(&shell->paths, 0);
+        return;
+    }
+
+    for(int x = 0; x < shell->paths.capacity; x++){
+        if(shell->paths.entries[x].name != NULL)
+            printf("%s\t%s\n", shell->paths.entries[x].name, shell->paths.entries[x].path);
+    }
+    fflush(stdout);
+}
+
+
+/*
+ * Resolves a command name to an executable path, walking $PATH only on a
+ * cache miss so repeat invocations cost zero PATH-probing syscalls. Names
+ * containing a slash bypass PATH (and the cache) entirely. Returns NULL when
+ * the command can't be found, in which case the caller falls back to
+ * posix_spawnp/execvp for the usual error reporting
+ */
+char* resolveCommandPath(struct shell* shell, char* name){
+    //a slash means the user already gave us the path
+    if(strchr(name, '/') != NULL)
+        return name;
+
+    //first external command allocates the cache, keeping startup zero-alloc
+    if(shell->paths.capacity == 0)
+        pathCacheInit(&shell->paths, PATH_CACHE_INITIAL_CAPACITY);
+
+    char* cached = pathCacheLookup(&shell->paths, name);
+    if(cached != NULL)
+        return cached;
+
+    char* pathEnv = getenv("PATH");
+    if(pathEnv == NULL)
+        return NULL;
+
+    //walk PATH once, probing each directory for an executable candidate
+    char candidate[MAX_INPUT];
+    char* dir = pathEnv;
+    while(1){
+        char* dirEnd = strchr(dir, ':');
+        int dirLen = (dirEnd != NULL) ? dirEnd - dir : (int)strlen(dir);
+
+        //an empty PATH component means the current directory
+        if(dirLen == 0)
+            snprintf(candidate, sizeof(candidate), "./%s", name);
         else
+            snprintf(candidate, sizeof(candidate), "%.*s/%s", dirLen, dir, name);
+
+        if(access(candidate, X_OK) == 0){
+            //directories that don't start with '/' resolve against the
+            //working directory, so cd must invalidate them
+            int relative = (candidate[0] != '/');
+            return pathCacheInsert(&shell->paths, name, candidate, relative);
+        }
+
+        if(dirEnd == NULL)
             break;
+        dir = dirEnd + 1;
     }
 
-    //reset cmdLineArgs
-    memset(shell->cmdLineArgs, '\0', MAX_ARGS);
+    return NULL;
+}
 
-    //free and reset input/output
-    free(shell->inputFile);
-    shell->inputFile = NULL;
-    free(shell->outputFile);
-    shell->outputFile = NULL;
 
-    //reset bgFlag to 0
-    shell->bgFlag = 0;
+/*
+ * The jobs builtin: lists each live background job's PID and command from the
+ * job table, plus a count of anything still waiting in the deferred queue
+ */
+void printBackgroundJobs(struct shell* shell){
+    //report anything that already finished first, so the listing is current
+    checkBackgroundProcessTermination(shell);
+
+    for(int x = 0; x < shell->jobs.capacity; x++){
+        if(shell->jobs.pids[x] != JOB_SLOT_EMPTY && shell->jobs.pids[x] != JOB_SLOT_REMOVED)
+            printf("%d\t%s\n", shell->jobs.pids[x], shell->jobs.cmds[x]);
+    }
+
+    if(shell->bgQueueCount > 0)
+        printf("%d job(s) queued\n", shell->bgQueueCount);
+
+    fflush(stdout);
 }
 
 
 /*
- * Looks through given string and replaces any instance of "$$" with the processes PID
+ * The wait builtin: "wait" blocks until every background job (queued ones
+ * included) has finished, "wait <pid>" blocks on that one job with a single
+ * blocking waitpid — no sleep-and-poll loops. SIGCHLD stays blocked while
+ * waiting so this loop and the async reaper can't race over a status
  */
-void pidReplacement(char* command){
-    int pid = getpid();
+void waitForBackgroundJobs(struct shell* shell){
+    sigset_t chldMask;
+    sigemptyset(&chldMask);
+    sigaddset(&chldMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chldMask, NULL);
+
+    //collect anything the reaper grabbed before we blocked it
+    checkBackgroundProcessTermination(shell);
+
+    //targeted wait: one blocking waitpid on the requested job
+    if(shell->cmdLineArgs[1] != NULL){
+        pid_t target = atoi(shell->cmdLineArgs[1]);
+
+        if(jobTableContains(&shell->jobs, target)){
+            int childStatus;
+            struct rusage childUsage;
+            if(wait4(target, &childStatus, 0, &childUsage) > 0){
+                accountChildUsage(shell, &childUsage);
+                jobTableRemove(&shell->jobs, target);
+
+                if(shell->notifyMode == NOTIFY_EACH)
+                    appendJobDoneReport(shell, target, childStatus);
+                appendJobSummaryReport(shell, 1,
+                    !WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0);
+            }
+        }
+    }
 
-    for (int x = 0; x < strlen(command); x++) {
-        // swapping $$ for %d so we can sprintf pid in
-        if(command[x] == '$' && x + 1 < strlen(command) &&
-            command[x + 1] == '$'){
-            //create a temporary command to use with sprintf
-            char* tempInput = malloc(strlen(command) + 1);
-            strcpy(tempInput, command);
+    //bare wait: reap until both the job table and the deferred queue are empty
+    else{
+        int burstDone = 0;
+        int burstFailed = 0;
+
+        while(shell->jobs.count > 0 || shell->bgQueueCount > 0){
+            //launches deferred jobs as slots open and drains the reap ring.
+            //a deferred launch unblocks SIGCHLD on its way out, so re-block
+            //before waiting
+            checkBackgroundProcessTermination(shell);
+            sigprocmask(SIG_BLOCK, &chldMask, NULL);
+
+            if(shell->jobs.count == 0)
+                continue;
+
+            int childStatus;
+            struct rusage childUsage;
+            pid_t childPID = wait4(-1, &childStatus, 0, &childUsage);
+            if(childPID <= 0){
+                if(errno == EINTR)
+                    continue;
+                //ECHILD: everything is already reaped and sitting in the ring
+                checkBackgroundProcessTermination(shell);
+                break;
+            }
 
-            //replace $$ with %d to use with sprintf
-            tempInput[x] = '%';
-            tempInput[x + 1] = 'd';
+            accountChildUsage(shell, &childUsage);
+            jobTableRemove(&shell->jobs, childPID);
 
-            //replace original $$ with pid
-            sprintf(command, tempInput, pid);
+            burstDone++;
+            if(!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0)
+                burstFailed++;
 
-            //free tempInput memory
-            free(tempInput);
+            if(shell->notifyMode == NOTIFY_EACH)
+                appendJobDoneReport(shell, childPID, childStatus);
         }
+
+        //jobs this loop reaped itself get their coalesced notice here; the
+        //ring-drained ones were already summarized per drain
+        appendJobSummaryReport(shell, burstDone, burstFailed);
     }
+
+    outputFlush(shell);
+    sigprocmask(SIG_UNBLOCK, &chldMask, NULL);
 }
 
 
 /*
- * Loops through the background process aray, for each index that holds a PID instead of 
- * a '0', checks if that process has finished running or not. If it has, it prints the
- * exit status of the process and clears the PID from the array. It does not wait for any
- * processes to finish, merely checks IF they are finished. 
+ * Shuts the worker pool down. Closing the task sockets delivers EOF, so the
+ * workers drain whatever was already dispatched and exit on their own; each
+ * is then reaped here with SIGCHLD blocked so the async reaper can't race
+ * over the statuses
  */
-void checkBackgroundProcessTermination(struct shell* shell){
-    int childStatus;
+void stopWorkerPool(struct shell* shell){
+    if(shell->pool.command == NULL)
+        return;
+
+    sigset_t chldMask;
+    sigemptyset(&chldMask);
+    sigaddset(&chldMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chldMask, NULL);
+
+    for(int x = 0; x < shell->pool.numWorkers; x++)
+        close(shell->pool.workerFds[x]);
+
+    //ECHILD here just means the async reaper got to a worker first
+    for(int x = 0; x < shell->pool.numWorkers; x++){
+        int workerStatus;
+        struct rusage workerUsage;
+        if(wait4(shell->pool.workerPids[x], &workerStatus, 0, &workerUsage) > 0)
+            accountChildUsage(shell, &workerUsage);
+    }
 
-    //check if each background process has terminated
-    for(int x = 0; x < 50; x++){
-        if(shell->bgProcesses[x] != 0){
-            if(waitpid(shell->bgProcesses[x], &childStatus, WNOHANG) != 0){
-
-                //check how background process exited and print exit/termination status
-                //code altered from module 4: monitoring child processes
-                if(WIFEXITED(childStatus)){
-                    //child terminated normally
-                    printf("Background pid %d is done: Exit value %d\n", shell->bgProcesses[x], WEXITSTATUS(childStatus));
-                } 
-                else{
-                    //child terminated abnormally
-                    printf("Background pid %d is done: Terminated by signal %d\n", shell->bgProcesses[x], WTERMSIG(childStatus));
-                }
+    free(shell->pool.command);
+    shell->pool.command = NULL;
+    shell->pool.numWorkers = 0;
+    shell->pool.next = 0;
+    shell->pool.tasksSent = 0;
 
-                shell->bgProcesses[x] = 0;
-            }
-        }
-    }
+    sigprocmask(SIG_UNBLOCK, &chldMask, NULL);
 }
 
 
 /*
- * Gets command line arguments from the user. Does not error handle correct command line
- * syntax. Parses entered commands and puts them in to an array of commands, which are then
- * checked for "$$" replacement, I/O redirects, and background command '&'. Clears IO 
- * and background commands from command line array as they will not be passed to execvp
- * later.
+ * The pool builtin: "pool start N cmd args..." preforks N persistent workers
+ * running cmd, each exec'd once with stdin wired to its own socketpair;
+ * "pool stop" EOFs and reaps them; "pool" alone reports the pool's state.
+ * While a pool runs, plain invocations of its command are dispatched to the
+ * workers as task lines instead of spawned — see poolDispatch
  */
-void getCommandLineArguments(struct shell* shell, int maxArgs){
-    int invalidInput = 1;
-    char userInput[MAX_INPUT];
-
+void manageWorkerPool(struct shell* shell){
+    char** args = shell->cmdLineArgs;
+
+    //"pool start N cmd args...": prefork the workers
+    if(args[1] != NULL && strcmp(args[1], "start") == 0){
+        if(shell->pool.command != NULL){
+            fprintf(stderr, "smallsh: pool: a pool for %s is already running\n",
+                    shell->pool.command);
+            return;
+        }
 
-    //loop until the user provides one or more valid commands
-    while(invalidInput){
-        checkBackgroundProcessTermination(shell);
-        printf(": ");
-        fflush(stdout);
-        fgets(userInput, MAX_INPUT, stdin);
-        
-        //check for comments/empty input
-        if(strlen(userInput) > 1 && userInput[0] != '#')
-            invalidInput = 0;
-    }
+        int numWorkers = args[2] != NULL ? atoi(args[2]) : 0;
+        char** workerArgv = &args[3];
+        if(numWorkers < 1 || numWorkers > POOL_MAX_WORKERS || workerArgv[0] == NULL){
+            fprintf(stderr, "smallsh: usage: pool start <1-%d> <command> [args...]\n",
+                    POOL_MAX_WORKERS);
+            return;
+        }
 
-    //---separate input in to individual arguments
+        //workers must not inherit a launch-time SIGCHLD block
+        posix_spawnattr_t spawnAttr;
+        posix_spawnattr_init(&spawnAttr);
+        sigset_t emptyMask;
+        sigemptyset(&emptyMask);
+        posix_spawnattr_setsigmask(&spawnAttr, &emptyMask);
+        posix_spawnattr_setflags(&spawnAttr, POSIX_SPAWN_SETSIGMASK);
+
+        for(int x = 0; x < numWorkers; x++){
+            int taskSocket[2];
+            if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, taskSocket) == -1){
+                perror("socketpair() failed!\n");
+                break;
+            }
 
-    //first get rid of extraneous newline character that fgets takes in
-    strtok(userInput, "\n");
+            //the dup2 file action clears close-on-exec on the worker's end
+            posix_spawn_file_actions_t fileActions;
+            posix_spawn_file_actions_init(&fileActions);
+            posix_spawn_file_actions_adddup2(&fileActions, taskSocket[0], 0);
+
+            int result = posix_spawnp(&shell->pool.workerPids[shell->pool.numWorkers],
+                                      workerArgv[0], &fileActions, &spawnAttr,
+                                      workerArgv, environ);
+            posix_spawn_file_actions_destroy(&fileActions);
+            close(taskSocket[0]);
+
+            if(result != 0){
+                errno = result;
+                perror(workerArgv[0]);
+                close(taskSocket[1]);
+                break;
+            }
 
-    //variables for tokenizing
-    char *saveptr;
-    int cmdNumber = 0;
+            shell->pool.workerFds[shell->pool.numWorkers] = taskSocket[1];
+            shell->pool.numWorkers++;
+        }
 
-    //grab and process the first command
-    char* token = strtok_r(userInput, " ", &saveptr);
-    shell->cmdLineArgs[cmdNumber] = malloc(strlen(token) + 1);
-    strcpy(shell->cmdLineArgs[cmdNumber], token);
-    cmdNumber++;
+        posix_spawnattr_destroy(&spawnAttr);
 
-    //continue grabbing and processing commands until there aren't any left
-    while(token = strtok_r(NULL, " ", &saveptr)){
-        //assign memory and copy over token
-        shell->cmdLineArgs[cmdNumber] = malloc(strlen(token) + 1);
-        strcpy(shell->cmdLineArgs[cmdNumber], token);
+        if(shell->pool.numWorkers > 0)
+            shell->pool.command = strdup(workerArgv[0]);
+        return;
+    }
 
-        //variable expansion
-        pidReplacement(shell->cmdLineArgs[cmdNumber]);
-        
-        cmdNumber++;
+    //"pool stop": EOF the workers and reap them
+    if(args[1] != NULL && strcmp(args[1], "stop") == 0){
+        stopWorkerPool(shell);
+        return;
     }
 
-    int IOstart = 0;
+    //"pool": report state
+    if(shell->pool.command == NULL)
+        printf("no worker pool running\n");
+    else
+        printf("%d worker(s) running %s, %ld task(s) dispatched\n",
+               shell->pool.numWorkers, shell->pool.command, shell->pool.tasksSent);
+    fflush(stdout);
+}
 
-    //check for input/output and set variables if necessary
-    for(int x = 0; x < cmdNumber; x++){
-        //check for input file
-        if(strcmp(shell->cmdLineArgs[x], "<") == 0){
 
-            //keep track of where IO starts in order to clear command line arguments later
-            if(IOstart == 0 || IOstart > x)
-                IOstart = x;
+/*
+ * The notify builtin selects the background-notification policy: "notify on"
+ * reports every job as it finishes (the interactive default), "notify summary"
+ * coalesces a burst of completions into one line at the next prompt, and
+ * "notify off" silences launch and completion notices entirely (the batch
+ * default, so captured stdout carries only command output). "notify" alone
+ * reports the current policy
+ */
+void manageNotifications(struct shell* shell){
+    char** args = shell->cmdLineArgs;
 
-            //assign memory for inputFile, then copy string over
-            shell->inputFile = malloc(strlen(shell->cmdLineArgs[x + 1]) + 1);
-            strcpy(shell->inputFile, shell->cmdLineArgs[x + 1]);
+    if(args[1] != NULL){
+        if(strcmp(args[1], "on") == 0){
+            shell->notifyMode = NOTIFY_EACH;
+            return;
+        }
+        if(strcmp(args[1], "summary") == 0){
+            shell->notifyMode = NOTIFY_SUMMARY;
+            return;
         }
+        if(strcmp(args[1], "off") == 0){
+            shell->notifyMode = NOTIFY_OFF;
+            return;
+        }
+        fprintf(stderr, "smallsh: usage: notify [on|summary|off]\n");
+        return;
+    }
+
+    char* modeNames[] = {"on", "summary", "off"};
+    printf("notify %s", modeNames[shell->notifyMode]);
+    if(shell->notifyFd != STDOUT_FILENO)
+        printf(" (fd %d)", shell->notifyFd);
+    printf("\n");
+    fflush(stdout);
+}
 
-        //check for output file
-        else if(strcmp(shell->cmdLineArgs[x], ">") == 0){
 
-            //keep track of where IO starts in order to clear command line arguments later
-            if(IOstart == 0 || IOstart > x)
-                IOstart = x;
+//builtin commands are dispatched through a jump table indexed by first letter,
+//built at compile time with designated initializers, with a few probe slots
+//per letter (pool, pushd, and popd all share 'p'). resolution is one index
+//plus at most a handful of strcmp verifies no matter how many builtins exist
+//— a new builtin is a table entry, not another branch in main
+#define BUILTIN_PROBE_SLOTS 3
 
-            //assign memory for outputFile, then copy string over
-            shell->outputFile = malloc(strlen(shell->cmdLineArgs[x + 1]) + 1);
-            strcpy(shell->outputFile, shell->cmdLineArgs[x + 1]);
-        }
+struct builtin{
+    char* name;
+    void (*handler)(struct shell*);
+};
 
-        //check if user wants to run in background
-        else if(strcmp(shell->cmdLineArgs[x], "&") == 0 && shell->cmdLineArgs[x + 1] ==  '\0'){
-            shell->bgFlag = 1;
+struct builtin builtinTable[26][BUILTIN_PROBE_SLOTS] = {
+    ['c' - 'a'] = {{"cd", changeShellDirectory}},
+    ['e' - 'a'] = {{"exit", exitSmallShell}},
+    ['h' - 'a'] = {{"hash", managePathCache}},
+    ['j' - 'a'] = {{"jobs", printBackgroundJobs}},
+    ['n' - 'a'] = {{"notify", manageNotifications}},
+    ['p' - 'a'] = {{"pool", manageWorkerPool}, {"pushd", pushShellDirectory},
+                   {"popd", popShellDirectory}},
+    ['s' - 'a'] = {{"status", printShellStatus}, {"stats", printShellStats}},
+    ['w' - 'a'] = {{"wait", waitForBackgroundJobs}},
+};
 
-            //clear & from the command arguments
-            free(shell->cmdLineArgs[x]);
-            shell->cmdLineArgs[x] = '\0';
-        }
-    }
 
-    //if there is IO, free and reset all commands after IOstart to '\0' for execvp later
-    if(IOstart != 0){
-        for(int x = IOstart; x < MAX_ARGS; x++){
-            if(shell->cmdLineArgs[x] != '\0'){
-                free(shell->cmdLineArgs[x]);
-                shell->cmdLineArgs[x] = '\0';
-            }
-        }
+/*
+ * Looks up the handler for a builtin command name in O(1). Returns NULL when
+ * the name is not a builtin and should run as an external command
+ */
+void (*lookupBuiltin(char* name))(struct shell*){
+    if(name[0] < 'a' || name[0] > 'z')
+        return NULL;
+
+    for(int x = 0; x < BUILTIN_PROBE_SLOTS; x++){
+        struct builtin* entry = &builtinTable[name[0] - 'a'][x];
+        if(entry->name != NULL && strcmp(entry->name, name) == 0)
+            return entry->handler;
     }
+
+    return NULL;
 }
 
 
 /*
- * Custom handler for SIGTSTP. Enters foreground-only mode if not already in it, otherwise
- * exits forground-only mode. 
+ * Fills in the spawn attributes shared by every posix_spawn launch: restore
+ * the default SIGINT disposition for foreground children (the shell itself
+ * ignores ^C) and hand the child an empty signal mask so it doesn't inherit
+ * the parent's temporary SIGCHLD block
  */
-void handle_SIGTSTP(int signo){
-    char* enterMessage = "\nEntering foreground-only mode (& is now ignored)\n";
-    int enterMessageLen = strlen(enterMessage);
+void setUpSpawnAttributes(struct shell* shell, posix_spawnattr_t* spawnAttr){
+    short spawnFlags = POSIX_SPAWN_SETSIGMASK;
+
+    if(shell->bgFlag == 0 || fgFlag == 1){
+        sigset_t defaultSigs;
+        sigemptyset(&defaultSigs);
+        sigaddset(&defaultSigs, SIGINT);
+        posix_spawnattr_setsigdefault(spawnAttr, &defaultSigs);
+        spawnFlags |= POSIX_SPAWN_SETSIGDEF;
+    }
+
+    sigset_t emptyMask;
+    sigemptyset(&emptyMask);
+    posix_spawnattr_setsigmask(spawnAttr, &emptyMask);
+    posix_spawnattr_setflags(spawnAttr, spawnFlags);
+}
 
-    char* exitMessage = "\nExiting foreground-only mode\n";
-    int exitMessageLen = strlen(exitMessage);
 
-    //toggle forground f
-    if(fgFlag == 0){
-        write(STDOUT_FILENO, enterMessage, enterMessageLen);
-        fgFlag = 1;
+/*
+ * Feeds the pending here-string payload to the just-launched child, then
+ * closes the pipe. Batch lines have no length cap, so the payload can exceed
+ * the pipe capacity and the write can block until the child drains it; the
+ * parent's read end closes first and SIGPIPE is ignored for the duration, so
+ * a child that exits without reading surfaces as EPIPE and the write gives
+ * up instead of hanging on a pipe nobody will ever drain
+ */
+void writeHereString(struct shell* shell){
+    if(shell->hereString == NULL || shell->herePipe[1] == -1)
+        return;
+
+    //the child holds its own copy of the read end; dropping the parent's
+    //now is what lets a dead reader turn in to EPIPE rather than a deadlock
+    close(shell->herePipe[0]);
+    shell->herePipe[0] = -1;
+
+    struct sigaction ignoreAction = {0};
+    struct sigaction savedAction;
+    ignoreAction.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignoreAction, &savedAction);
+
+    char* cursor = shell->hereString;
+    long remaining = strlen(shell->hereString);
+    while(remaining > 0){
+        long written = write(shell->herePipe[1], cursor, remaining);
+        if(written == -1){
+            if(errno == EINTR)
+                continue;
+            break; //EPIPE: the child exited without reading the rest
+        }
+        cursor += written;
+        remaining -= written;
     }
-    else{
-        write(STDOUT_FILENO, exitMessage, exitMessageLen);
-        fgFlag = 0;
-    } 
+    if(remaining == 0)
+        write(shell->herePipe[1], "\n", 1);
+
+    sigaction(SIGPIPE, &savedAction, NULL);
+
+    close(shell->herePipe[1]);
+    shell->herePipe[1] = -1;
 }
 
 
 /*
- * Kills any running child processes and sets variable to exit the shell in main loop
+ * Closes any pre-opened redirect fds still held by the parent. Called after
+ * the launch: the children own dup2'd copies by then
  */
-void exitSmallShell(struct shell* shell){
-    //kill any running child processes
-    for(int x = 0; x < 50; x++){
-        if(shell->bgProcesses[x] != 0)
-            kill(shell->bgProcesses[x], SIGKILL);
+void closeRedirectFiles(struct shell* shell){
+    if(shell->inputFd != -1){
+        close(shell->inputFd);
+        shell->inputFd = -1;
+    }
+    if(shell->outputFd != -1){
+        close(shell->outputFd);
+        shell->outputFd = -1;
     }
-    //set variable to terminate while loop
-    shell->exitShell = 1;
 }
 
 
 /*
- * Prints the exit status of either the most recently ran foreground process, or the 
- * current exit status of the shell if no foreground processes have been run
+ * Opens any redirect targets in the parent before the launch: the child gets
+ * ready fds for plain dup2 instead of paying blocking opens after the fork,
+ * and an unopenable file is reported here without costing a wasted fork.
+ * Returns 0 when the launch can proceed, -1 when a target failed to open
  */
-void printShellStatus(struct shell* shell){
-    //if exitStatus is 0, that means last exit was normal
-    if(shell->exitStatus == 0)
-        printf("exit value %d\n", 0);
+int openRedirectFiles(struct shell* shell){
+    if(shell->inputFile != NULL){
+        shell->inputFd = open(shell->inputFile, O_RDONLY | O_CLOEXEC);
+        if(shell->inputFd == -1){
+            printf("Cannot open %s for input\n", shell->inputFile);
+            fflush(stdout);
+            shell->exitStatus = EXIT_FAILURE << 8;
+            return -1;
+        }
+    }
 
-    //if last exit wasn't 0, check if last child exited normally or abnormally
-    else if(WIFEXITED(shell->exitStatus)){
-        //child terminated normally
-        printf("exit value %d\n", WEXITSTATUS(shell->exitStatus));
-    } 
-    else{
-        //child terminated abnormally
-        printf("terminated by signal %d\n", WTERMSIG(shell->exitStatus));
+    if(shell->outputFile != NULL){
+        shell->outputFd = open(shell->outputFile,
+                               O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(shell->outputFd == -1){
+            printf("Cannot open %s for output\n", shell->outputFile);
+            fflush(stdout);
+            shell->exitStatus = EXIT_FAILURE << 8;
+            closeRedirectFiles(shell);
+            return -1;
+        }
     }
 
-    fflush(stdout);
+    return 0;
 }
 
 
 /*
- * Changes the directory of the shell based on user input. If no path was given, changes
- * directory to home directory
+ * Fast path for launching an external command with posix_spawn instead of
+ * fork. On Linux this gets vfork/CLONE_VM semantics, so launch cost stays flat
+ * no matter how large the shell's own footprint has grown. Redirects are
+ * expressed as file actions and the foreground SIGINT disposition as a spawn
+ * attribute. Returns 0 and fills in shell->childPID on success, nonzero when
+ * the caller should fall back to the fork path (which also reproduces any
+ * error message the child would have printed)
  */
-void changeShellDirectory(struct shell* shell){
-    //if user entered a path, go there
-    if(shell->cmdLineArgs[1] != '\0'){
-        chdir(shell->cmdLineArgs[1]);
-    }
-    //otherwise go to the home directory
-    else {
-        chdir(getenv("HOME"));
-    }
+int spawnNewProcess(struct shell* shell){
+    posix_spawn_file_actions_t fileActions;
+    posix_spawnattr_t spawnAttr;
+
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawnattr_init(&spawnAttr);
+
+    //input: here-string pipe, the pre-opened redirect fd, or /dev/null for
+    //background commands
+    if(shell->hereString != NULL)
+        posix_spawn_file_actions_adddup2(&fileActions, shell->herePipe[0], 0);
+    else if(shell->inputFd != -1)
+        posix_spawn_file_actions_adddup2(&fileActions, shell->inputFd, 0);
+    else if(shell->bgFlag == 1)
+        posix_spawn_file_actions_addopen(&fileActions, 0, "/dev/null", O_RDONLY, 0);
+
+    //output redirect: the pre-opened fd, or /dev/null for background commands
+    if(shell->outputFd != -1)
+        posix_spawn_file_actions_adddup2(&fileActions, shell->outputFd, 1);
+    else if(shell->bgFlag == 1)
+        posix_spawn_file_actions_addopen(&fileActions, 1, "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    setUpSpawnAttributes(shell, &spawnAttr);
+
+    //launch straight from the cached path when we have one, skipping the
+    //child-side PATH walk; unknown commands go through posix_spawnp so the
+    //failure is reported the usual way
+    char* resolvedPath = resolveCommandPath(shell, shell->cmdLineArgs[0]);
+    int result;
+    if(resolvedPath != NULL)
+        result = posix_spawn(&shell->childPID, resolvedPath, &fileActions,
+                             &spawnAttr, shell->cmdLineArgs, environ);
+    else
+        result = posix_spawnp(&shell->childPID, shell->cmdLineArgs[0], &fileActions,
+                              &spawnAttr, shell->cmdLineArgs, environ);
+
+    posix_spawn_file_actions_destroy(&fileActions);
+    posix_spawnattr_destroy(&spawnAttr);
+
+    return result;
 }
 
 
 /*
- * Forks and creates a new process in either the foreground or background, depending on
- * command line inputs. Redirects input/output if requested by user. 
+ * Fallback path that forks and execs an external command, used when
+ * posix_spawn could not launch it (bad command, unopenable redirect file):
+ * the child reproduces the error message and exit status the user expects.
+ * Only the parent returns from this function
  */
-void createNewProcess(struct shell* shell, struct sigaction SIGINT_action){
-    int childStatus;
+void forkNewProcess(struct shell* shell, struct sigaction SIGINT_action, sigset_t chldMask){
     //fork a child process
     shell->childPID = fork();
 
     switch(shell->childPID){
-        case -1: 
+        case -1:
             //fork and the creation of child process failed
             perror("fork() failed!\n");
             fflush(stdout);
@@ -346,159 +3184,724 @@ void createNewProcess(struct shell* shell, struct sigaction SIGINT_action){
         case 0:
             //child will execute code in this branch
 
+            //undo the parent's SIGCHLD block so it isn't inherited across exec
+            sigprocmask(SIG_UNBLOCK, &chldMask, NULL);
+
             //if child is running in forground, don't ignore ^C
             if(shell->bgFlag == 0 || fgFlag == 1){
                 SIGINT_action.sa_handler = SIG_DFL;
                 sigaction(SIGINT, &SIGINT_action, NULL);
             }
             
-            //check if input redirect is needed (code adapted from module 4: processes and I/O)
-            if(shell->inputFile != NULL || shell->bgFlag == 1){
-
-                //open source file
-                int sourceFD;  
-
-                //open file if user entered it, otherwise redirect to /dev/null 
-                //in case of background process
-                if(shell->inputFile != NULL)
-                    sourceFD = open(shell->inputFile, O_RDONLY);
-                else
-                    sourceFD = open("/dev/null", O_RDONLY);
-
-                if (sourceFD == -1) {
-                    printf("Cannot open %s for input\n", shell->inputFile);
-                    exit(1); 
+            //a here-string payload arrives through the pipe instead of a file
+            if(shell->hereString != NULL){
+                if(dup2(shell->herePipe[0], 0) == -1){
+                    perror("Unable to reroute stdin to here-string pipe");
+                    exit(2);
                 }
+            }
 
-                //redirect stdin to source file
-                int result = dup2(sourceFD, 0);
-                if (result == -1) { 
-                    perror("Unable to reroute stdin to requested file"); 
-                    exit(2); 
+            //an input redirect arrives as a fd the parent already opened
+            else if(shell->inputFd != -1){
+                if(dup2(shell->inputFd, 0) == -1){
+                    perror("Unable to reroute stdin to requested file");
+                    exit(2);
                 }
+            }
 
-                //set trigger to close file when child exits
-                fcntl(sourceFD, F_SETFD, FD_CLOEXEC);
-            }
-
-            //check if output redirect is needed (code adapted from module 4: processes and I/O)
-            if(shell->outputFile != NULL || shell->bgFlag == 1){
-                //open the output file
-                int outputFD;
-                
-                //open file if user entered it, otherwise redirect to /dev/null
-                //in case of background process
-                if(shell->outputFile != NULL)
-                    outputFD = open(shell->outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                else
-                    outputFD = open("/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
-
-                if (outputFD == -1) { 
-                    printf("Cannot open %s for input\n", shell->outputFile);
-                    exit(1); 
+            //background processes with no redirect read from /dev/null
+            else if(shell->bgFlag == 1){
+                int sourceFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if(sourceFD == -1 || dup2(sourceFD, 0) == -1){
+                    perror("Unable to reroute stdin to /dev/null");
+                    exit(2);
                 }
+            }
 
-                // Redirect stdout to target file
-                int result = dup2(outputFD, 1);
-                if (result == -1) { 
-                    perror("Unable to reroute stdout to requested file"); 
-                    exit(2); 
+            //same for stdout: a pre-opened fd, or /dev/null in the background
+            if(shell->outputFd != -1){
+                if(dup2(shell->outputFd, 1) == -1){
+                    perror("Unable to reroute stdout to requested file");
+                    exit(2);
+                }
+            }
+            else if(shell->bgFlag == 1){
+                int outputFD = open("/dev/null", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if(outputFD == -1 || dup2(outputFD, 1) == -1){
+                    perror("Unable to reroute stdout to /dev/null");
+                    exit(2);
                 }
-
-                //set trigger to close file when child exits
-                fcntl(outputFD, F_SETFD, FD_CLOEXEC);
             }
 
             //run commands through execvp, printing if an error occurred
             if(execvp(shell->cmdLineArgs[0], shell->cmdLineArgs)){
-                perror(shell->cmdLineArgs[0]); 
+                perror(shell->cmdLineArgs[0]);
                 exit(EXIT_FAILURE);
             }
             break;
 
         default:
-            //parent will execeute code in this branch
+            //parent falls through; createNewProcess handles the bookkeeping
+            break;
+    }
+}
 
-            //print process PID if running in background and add to bg array
-            if(shell->bgFlag == 1 && fgFlag == 0){
 
-                //loop for an "empty" index to add PID to
-                for(int x = 0; x < 50; x++){
-                    if(shell->bgProcesses[x] == 0){
-                        shell->bgProcesses[x] = shell->childPID;
-                        break;
-                    }
-                }
+/*
+ * Runs a multi-stage pipeline: spawns every stage concurrently with a
+ * close-on-exec pipe between each adjacent pair, so bytes move kernel buffer
+ * to kernel buffer with no temp files and the stages overlap on separate
+ * cores. Input redirection applies to the first stage and output redirection
+ * to the last. A foreground pipeline is reaped as a set with the last stage's
+ * status becoming the shell status; a background pipeline puts every stage in
+ * the job table
+ */
+void launchPipeline(struct shell* shell){
+    int numStages = shell->numStages;
+    pid_t stagePIDs[MAX_PIPELINE_STAGES];
+    int stagePipes[MAX_PIPELINE_STAGES - 1][2];
+
+    //reject pipelines the parser had to truncate: running the mangled
+    //remainder as stage arguments would execute a garbage command
+    if(shell->stageOverflow){
+        fprintf(stderr, "smallsh: syntax error: too many pipeline stages (max %d)\n",
+                MAX_PIPELINE_STAGES);
+        return;
+    }
+
+    //reject pipelines with an empty stage, e.g. "a | | b" or "a |"
+    for(int x = 0; x < numStages; x++){
+        if(shell->cmdLineArgs[shell->stageStart[x]] == NULL){
+            fprintf(stderr, "smallsh: syntax error: empty pipeline stage\n");
+            return;
+        }
+    }
 
-                printf("Background PID is %d\n", shell->childPID);
-                fflush(stdout);
+    //one pipe between each pair of adjacent stages. O_CLOEXEC means no child
+    //has to close the ends it doesn't use: exec drops them automatically
+    for(int x = 0; x < numStages - 1; x++){
+        if(pipe2(stagePipes[x], O_CLOEXEC) == -1){
+            perror("pipe2() failed!\n");
+            for(int y = 0; y < x; y++){
+                close(stagePipes[y][0]);
+                close(stagePipes[y][1]);
             }
+            return;
+        }
+    }
 
+    //spawn every stage; dup2 file actions clear close-on-exec on the two
+    //pipe ends each stage actually uses
+    long spawnStart = monotonicNs();
+    for(int x = 0; x < numStages; x++){
+        char** stageArgv = &shell->cmdLineArgs[shell->stageStart[x]];
+
+        posix_spawn_file_actions_t fileActions;
+        posix_spawnattr_t spawnAttr;
+        posix_spawn_file_actions_init(&fileActions);
+        posix_spawnattr_init(&spawnAttr);
+
+        //stdin: previous stage's pipe, or the pipeline-level here-string or
+        //input redirect
+        if(x > 0)
+            posix_spawn_file_actions_adddup2(&fileActions, stagePipes[x - 1][0], 0);
+        else if(shell->hereString != NULL)
+            posix_spawn_file_actions_adddup2(&fileActions, shell->herePipe[0], 0);
+        else if(shell->inputFd != -1)
+            posix_spawn_file_actions_adddup2(&fileActions, shell->inputFd, 0);
+        else if(shell->bgFlag == 1)
+            posix_spawn_file_actions_addopen(&fileActions, 0, "/dev/null", O_RDONLY, 0);
+
+        //stdout: next stage's pipe, or the pipeline-level output redirect
+        if(x < numStages - 1)
+            posix_spawn_file_actions_adddup2(&fileActions, stagePipes[x][1], 1);
+        else if(shell->outputFd != -1)
+            posix_spawn_file_actions_adddup2(&fileActions, shell->outputFd, 1);
+        else if(shell->bgFlag == 1)
+            posix_spawn_file_actions_addopen(&fileActions, 1, "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        setUpSpawnAttributes(shell, &spawnAttr);
+
+        //stages resolve through the path cache just like single commands
+        char* resolvedPath = resolveCommandPath(shell, stageArgv[0]);
+        int result;
+        if(resolvedPath != NULL)
+            result = posix_spawn(&stagePIDs[x], resolvedPath, &fileActions,
+                                 &spawnAttr, stageArgv, environ);
+        else
+            result = posix_spawnp(&stagePIDs[x], stageArgv[0], &fileActions,
+                                  &spawnAttr, stageArgv, environ);
 
-            //wait for child to terminate
-            else{
-                waitpid(shell->childPID, &(shell->exitStatus), 0);
+        posix_spawn_file_actions_destroy(&fileActions);
+        posix_spawnattr_destroy(&spawnAttr);
 
-                //if child terminated abnormally, print out signal
-                if(WIFSIGNALED(shell->exitStatus)){
-                    printf("terminated by signal %d\n", WTERMSIG(shell->exitStatus));
-                }
+        //a stage that fails to launch is reported but doesn't kill the rest
+        if(result != 0){
+            errno = result;
+            perror(stageArgv[0]);
+            stagePIDs[x] = -1;
+        }
+    }
+
+    //the parent holds no pipeline data: close every pipe end so each stage
+    //sees EOF as soon as its upstream neighbor exits
+    for(int x = 0; x < numStages - 1; x++){
+        close(stagePipes[x][0]);
+        close(stagePipes[x][1]);
+    }
+
+    //feed the first stage its here-string payload, if there is one
+    writeHereString(shell);
+    histogramRecord(&shell->spawnHist, monotonicNs() - spawnStart);
+
+    //background pipeline: track every stage in the job table
+    if(shell->bgFlag == 1 && fgFlag == 0){
+        pid_t lastPID = -1;
+        for(int x = 0; x < numStages; x++){
+            if(stagePIDs[x] != -1){
+                jobTableAdd(&shell->jobs, stagePIDs[x], shell->cmdLineArgs[shell->stageStart[x]]);
+                lastPID = stagePIDs[x];
+            }
+        }
+
+        if(lastPID != -1)
+            appendJobStartReport(shell, lastPID);
+    }
+
+    //foreground pipeline: reap the whole set, status comes from the last stage
+    else{
+        long waitStart = monotonicNs();
+        for(int x = 0; x < numStages; x++){
+            int stageStatus;
+            struct rusage stageUsage;
+
+            //a stage that never launched counts as exit value 1
+            if(stagePIDs[x] == -1)
+                stageStatus = EXIT_FAILURE << 8;
+            else if(wait4(stagePIDs[x], &stageStatus, 0, &stageUsage) > 0){
+                accountChildUsage(shell, &stageUsage);
+                if(shell->rusageReport)
+                    appendUsageReport(shell, stagePIDs[x], &stageUsage);
             }
+
+            if(x == numStages - 1)
+                shell->exitStatus = stageStatus;
+        }
+        histogramRecord(&shell->waitHist, monotonicNs() - waitStart);
+
+        //if the last stage terminated abnormally, print out signal
+        if(WIFSIGNALED(shell->exitStatus)){
+            outputAppendLiteral(shell, "terminated by signal ");
+            outputAppendInt(shell, WTERMSIG(shell->exitStatus));
+            outputAppendLiteral(shell, "\n");
+            outputFlush(shell);
+        }
+    }
+}
+
+
+/*
+ * Deep-copies the currently parsed background command off the arena and
+ * appends it to the deferred-job queue, to be launched when the reaper frees
+ * a concurrency slot
+ */
+void enqueueBackgroundJob(struct shell* shell){
+    struct queuedJob* job = malloc(sizeof(struct queuedJob));
+
+    //the argv span runs to the NULL terminating the last pipeline stage
+    int argCount = shell->stageStart[shell->numStages - 1];
+    while(shell->cmdLineArgs[argCount] != NULL)
+        argCount++;
+
+    //total up the string bytes so everything packs in to one allocation
+    int stringBytes = 0;
+    for(int x = 0; x < argCount; x++){
+        if(shell->cmdLineArgs[x] != NULL)
+            stringBytes += strlen(shell->cmdLineArgs[x]) + 1;
+    }
+    if(shell->inputFile != NULL)
+        stringBytes += strlen(shell->inputFile) + 1;
+    if(shell->outputFile != NULL)
+        stringBytes += strlen(shell->outputFile) + 1;
+    if(shell->hereString != NULL)
+        stringBytes += strlen(shell->hereString) + 1;
+
+    job->argStorage = malloc(stringBytes);
+    job->args = malloc((argCount + 1) * sizeof(char*));
+    job->argCount = argCount;
+
+    //copy each string in to the packed storage, keeping the NULL separators
+    //between pipeline stages where they are
+    char* out = job->argStorage;
+    for(int x = 0; x < argCount; x++){
+        if(shell->cmdLineArgs[x] == NULL){
+            job->args[x] = NULL;
+        }
+        else{
+            job->args[x] = out;
+            out += sprintf(out, "%s", shell->cmdLineArgs[x]) + 1;
+        }
+    }
+    job->args[argCount] = NULL;
+
+    job->inputFile = NULL;
+    if(shell->inputFile != NULL){
+        job->inputFile = out;
+        out += sprintf(out, "%s", shell->inputFile) + 1;
+    }
+
+    job->outputFile = NULL;
+    if(shell->outputFile != NULL){
+        job->outputFile = out;
+        out += sprintf(out, "%s", shell->outputFile) + 1;
+    }
+
+    job->hereString = NULL;
+    if(shell->hereString != NULL){
+        job->hereString = out;
+        out += sprintf(out, "%s", shell->hereString) + 1;
+    }
+
+    job->numStages = shell->numStages;
+    memcpy(job->stageStart, shell->stageStart, sizeof(job->stageStart));
+
+    //append to the FIFO tail
+    job->next = NULL;
+    if(shell->bgQueueTail != NULL)
+        shell->bgQueueTail->next = job;
+    else
+        shell->bgQueueHead = job;
+    shell->bgQueueTail = job;
+    shell->bgQueueCount++;
+}
+
+
+/*
+ * Dispatches an invocation of the pool's designated command to the next
+ * worker as one task line: the arguments joined by spaces, newline
+ * terminated, in a single MSG_NOSIGNAL send (a dead worker costs an EPIPE,
+ * not a SIGPIPE). Returns 1 when the command was handled here, 0 when it
+ * should launch as a normal process — redirects, pipelines, and "&" always
+ * fall through to the normal launch path
+ */
+int poolDispatch(struct shell* shell){
+    if(shell->pool.command == NULL || shell->numStages > 1 ||
+       shell->bgFlag == 1 || shell->inputFile != NULL ||
+       shell->outputFile != NULL || shell->hereString != NULL)
+        return 0;
+    if(strcmp(shell->cmdLineArgs[0], shell->pool.command) != 0)
+        return 0;
+
+    //join the argv in to one task line
+    char taskLine[MAX_INPUT];
+    int len = 0;
+    for(int x = 1; shell->cmdLineArgs[x] != NULL; x++){
+        int argLen = strlen(shell->cmdLineArgs[x]);
+
+        //a line too long for the buffer runs as a normal process instead
+        if(len + argLen + 2 > (int)sizeof(taskLine))
+            return 0;
+
+        if(len > 0)
+            taskLine[len++] = ' ';
+        memcpy(taskLine + len, shell->cmdLineArgs[x], argLen);
+        len += argLen;
+    }
+    taskLine[len++] = '\n';
+
+    if(send(shell->pool.workerFds[shell->pool.next], taskLine, len,
+            MSG_NOSIGNAL) == -1){
+        perror(shell->pool.command);
+        shell->exitStatus = EXIT_FAILURE << 8;
+    }
+    else{
+        shell->exitStatus = 0;
+        shell->pool.tasksSent++;
+    }
+
+    shell->pool.next = (shell->pool.next + 1) % shell->pool.numWorkers;
+    return 1;
+}
+
+
+/*
+ * Creates a new process in either the foreground or background, depending on
+ * command line inputs. Redirects input/output if requested by user. Launches
+ * through the posix_spawn fast path when possible, falling back to fork.
+ * Background commands past the concurrency limit are queued instead of
+ * launched, keeping fan-out scripts from oversubscribing the machine
+ */
+void createNewProcess(struct shell* shell){
+    //an active worker pool intercepts its designated command: the argv is
+    //handed to a persistent worker instead of costing a fork+exec
+    if(poolDispatch(shell))
+        return;
+
+    //background concurrency limit, resolved on first use:
+    //SMALLSH_MAX_BG, or twice the online cores
+    if(shell->maxBackground == 0){
+        char* maxBgEnv = getenv("SMALLSH_MAX_BG");
+        if(maxBgEnv != NULL && atoi(maxBgEnv) > 0)
+            shell->maxBackground = atoi(maxBgEnv);
+        else
+            shell->maxBackground = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+    }
+
+    //defer this background command if every concurrency slot is taken; a
+    //truncated pipeline falls through so launchPipeline can reject it
+    if(shell->bgFlag == 1 && fgFlag == 0 && !shell->stageOverflow &&
+       shell->jobs.count >= shell->maxBackground){
+        enqueueBackgroundJob(shell);
+        return;
+    }
+
+    //block SIGCHLD across the launch so the async reaper cannot steal a
+    //foreground child's status, and so a background pid is recorded in the
+    //job table before the handler can try to clear it
+    sigset_t chldMask;
+    sigemptyset(&chldMask);
+    sigaddset(&chldMask, SIGCHLD);
+
+    //grow the job table now if needed so the launch hot path never allocates
+    jobTableEnsureCapacity(&shell->jobs);
+
+    //open redirect targets up front: the children get ready fds to dup2 and
+    //an unopenable file is reported before any fork or spawn is paid for
+    if(openRedirectFiles(shell) == -1)
+        return;
+
+    sigprocmask(SIG_BLOCK, &chldMask, NULL);
+
+    //a here-string feeds the child's stdin through a pipe, no temp file
+    if(shell->hereString != NULL && pipe2(shell->herePipe, O_CLOEXEC) == -1){
+        perror("pipe2() failed!\n");
+        shell->hereString = NULL;
+    }
+
+    //multi-stage pipelines do their own plumbing and reaping
+    if(shell->numStages > 1){
+        launchPipeline(shell);
+        closeRedirectFiles(shell);
+        sigprocmask(SIG_UNBLOCK, &chldMask, NULL);
+        return;
     }
+
+    //try the fast path first, falling back to fork only when it fails
+    long spawnStart = monotonicNs();
+    if(spawnNewProcess(shell) != 0)
+        forkNewProcess(shell, shell->SIGINT_action, chldMask);
+    histogramRecord(&shell->spawnHist, monotonicNs() - spawnStart);
+
+    //the child holds its own copies of the redirect fds and the pipe read
+    //end now: feed the here-string payload and drop the parent's fds
+    writeHereString(shell);
+    closeRedirectFiles(shell);
+
+    //print process PID if running in background and add to job table
+    if(shell->bgFlag == 1 && fgFlag == 0){
+        jobTableAdd(&shell->jobs, shell->childPID, shell->cmdLineArgs[0]);
+        appendJobStartReport(shell, shell->childPID);
+    }
+
+    //wait for child to terminate
+    else{
+        long waitStart = monotonicNs();
+        struct rusage childUsage;
+        wait4(shell->childPID, &(shell->exitStatus), 0, &childUsage);
+        histogramRecord(&shell->waitHist, monotonicNs() - waitStart);
+
+        accountChildUsage(shell, &childUsage);
+        if(shell->rusageReport)
+            appendUsageReport(shell, shell->childPID, &childUsage);
+
+        //if child terminated abnormally, print out signal
+        if(WIFSIGNALED(shell->exitStatus)){
+            outputAppendLiteral(shell, "terminated by signal ");
+            outputAppendInt(shell, WTERMSIG(shell->exitStatus));
+            outputAppendLiteral(shell, "\n");
+            outputFlush(shell);
+        }
+    }
+
+    //safe to let the async reaper run again: the foreground child is
+    //already reaped and any background pid is already recorded
+    sigprocmask(SIG_UNBLOCK, &chldMask, NULL);
+}
+
+
+/*
+ * Launches deferred background jobs from the FIFO queue for as long as free
+ * concurrency slots remain. This can run in the middle of a builtin (wait
+ * drains the reaper) or between segments of a command list, so the in-flight
+ * command's argv, redirect fields, chain state, and arena must all survive:
+ * the live fields are set aside, each job's own packed storage is fed to the
+ * launch path directly, and everything is put back before returning — the
+ * shell's argv array and arena are never touched
+ */
+void launchQueuedJobs(struct shell* shell){
+    if(shell->bgQueueCount == 0 || shell->jobs.count >= shell->maxBackground)
+        return;
+
+    //set the in-flight command aside
+    char** savedArgs = shell->cmdLineArgs;
+    int savedCapacity = shell->cmdLineArgsCapacity;
+    int savedCount = shell->cmdLineArgCount;
+    char* savedInputFile = shell->inputFile;
+    char* savedOutputFile = shell->outputFile;
+    char* savedHereString = shell->hereString;
+    char* savedChainRest = shell->chainRest;
+    int savedChainOp = shell->chainOp;
+    int savedNumStages = shell->numStages;
+    int savedStageStart[MAX_PIPELINE_STAGES];
+    memcpy(savedStageStart, shell->stageStart, sizeof(savedStageStart));
+    int savedStageOverflow = shell->stageOverflow;
+    int savedBgFlag = shell->bgFlag;
+
+    while(shell->bgQueueCount > 0 && shell->jobs.count < shell->maxBackground){
+        //pop the oldest deferred job
+        struct queuedJob* job = shell->bgQueueHead;
+        shell->bgQueueHead = job->next;
+        if(shell->bgQueueHead == NULL)
+            shell->bgQueueTail = NULL;
+        shell->bgQueueCount--;
+
+        //the job's own argv array goes in whole — nothing is copied in to
+        //the shell's array, which still belongs to the in-flight command
+        shell->cmdLineArgs = job->args;
+        shell->cmdLineArgsCapacity = job->argCount + 1;
+        shell->cmdLineArgCount = job->argCount;
+        shell->inputFile = job->inputFile;
+        shell->outputFile = job->outputFile;
+        shell->hereString = job->hereString;
+        shell->chainRest = NULL;
+        shell->numStages = job->numStages;
+        memcpy(shell->stageStart, job->stageStart, sizeof(shell->stageStart));
+        shell->stageOverflow = 0;
+        shell->bgFlag = 1;
+
+        createNewProcess(shell);
+
+        free(job->args);
+        free(job->argStorage);
+        free(job);
+    }
+
+    //put the in-flight command back exactly as it was
+    shell->cmdLineArgs = savedArgs;
+    shell->cmdLineArgsCapacity = savedCapacity;
+    shell->cmdLineArgCount = savedCount;
+    shell->inputFile = savedInputFile;
+    shell->outputFile = savedOutputFile;
+    shell->hereString = savedHereString;
+    shell->chainRest = savedChainRest;
+    shell->chainOp = savedChainOp;
+    shell->numStages = savedNumStages;
+    memcpy(shell->stageStart, savedStageStart, sizeof(shell->stageStart));
+    shell->stageOverflow = savedStageOverflow;
+    shell->bgFlag = savedBgFlag;
 }
 
 
-int main(void){
+int main(int argc, char* argv[]){
     //set up our small shell struct
     struct shell* shell = shellSetUp();
 
-    //ignore ^C signals in main
-    struct sigaction SIGINT_action = {0};
-    SIGINT_action.sa_handler = SIG_IGN;
-    sigfillset(&SIGINT_action.sa_mask);
-    SIGINT_action.sa_flags = 0;
-    sigaction(SIGINT, &SIGINT_action, NULL);
+    //figure out where commands are coming from: a -c string, a script file,
+    //a non-tty stdin (slurped in one go), or an interactive terminal
+    //--journal runs a script with the crash-safe command journal enabled;
+    //--resume reopens a journal, reloads the script it names, and skips
+    //every line a previous run already completed
+    if(argc >= 4 && strcmp(argv[1], "--journal") == 0){
+        loadScriptFile(shell, argv[3]);
+        journalOpen(shell, argv[2], argv[3]);
+    }
+    else if(argc >= 3 && strcmp(argv[1], "--resume") == 0){
+        journalResume(shell, argv[2]);
+    }
+    else if(argc >= 3 && strcmp(argv[1], "-c") == 0){
+        shell->scriptBuffer = strdup(argv[2]);
+        shell->interactive = 0;
+    }
+    else if(argc >= 2){
+        loadScriptFile(shell, argv[1]);
+    }
+    else if(!isatty(STDIN_FILENO)){
+        shell->scriptBuffer = readAllInput(STDIN_FILENO);
+        shell->interactive = 0;
+    }
+
+    //batch mode gets its preflight pass: the script splits in to an index of
+    //executable lines once, up front, instead of a scan per command
+    if(shell->scriptBuffer != NULL)
+        preflightScript(shell);
+
+    //a resumed run picks up after the last line its journal marked complete
+    if(shell->journalSkipLines > 0){
+        shell->scriptLineNext = shell->journalSkipLines < shell->scriptLineCount ?
+                                shell->journalSkipLines : shell->scriptLineCount;
+    }
+
+    //batch runs default to quiet so captured stdout carries only command
+    //output; SMALLSH_NOTIFY_FD reroutes notices to a dedicated fd (and turns
+    //them back on) for harnesses that want them out-of-band
+    if(!shell->interactive)
+        shell->notifyMode = NOTIFY_OFF;
+    char* notifyFdEnv = getenv("SMALLSH_NOTIFY_FD");
+    if(notifyFdEnv != NULL && atoi(notifyFdEnv) > 0){
+        shell->notifyFd = atoi(notifyFdEnv);
+        shell->notifyMode = NOTIFY_EACH;
+    }
+
+    //interactive sessions get persistent history: replay the file in to the
+    //ring, then keep it open for one append per command
+    if(shell->interactive){
+        char historyPath[MAX_INPUT];
+        char* home = getenv("HOME");
+        if(home != NULL){
+            snprintf(historyPath, sizeof(historyPath), "%s/.smallsh_history", home);
+
+            int readFd = open(historyPath, O_RDONLY);
+            if(readFd != -1){
+                char* oldHistory = readAllInput(readFd);
+                close(readFd);
+
+                //replay each saved line without re-appending it to the file
+                char* saveptr;
+                for(char* entry = strtok_r(oldHistory, "\n", &saveptr);
+                    entry != NULL; entry = strtok_r(NULL, "\n", &saveptr))
+                    historyAdd(shell, entry, 0);
+
+                free(oldHistory);
+            }
+
+            shell->historyFd = open(historyPath, O_WRONLY | O_CREAT | O_APPEND, 0600);
+        }
+    }
+
+    //the ^C and ^Z dispositions only matter with a person at a terminal, so
+    //batch runs skip both sigaction calls on the way to their first exec
+    if(shell->interactive){
+        //ignore ^C signals in main; the disposition is kept in the shell
+        //struct so deferred background launches can restore it in forked
+        //children
+        shell->SIGINT_action.sa_handler = SIG_IGN;
+        sigfillset(&shell->SIGINT_action.sa_mask);
+        shell->SIGINT_action.sa_flags = 0;
+        sigaction(SIGINT, &shell->SIGINT_action, NULL);
+
+        //set up ^Z foreground mode signal
+        struct sigaction SIGTSTP_action = {0};
+        SIGTSTP_action.sa_handler = handle_SIGTSTP;
+        sigfillset(&SIGTSTP_action.sa_mask);
+        SIGTSTP_action.sa_flags = 0;
+        sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+    }
 
-    //set up ^Z foreground mode signal
-    struct sigaction SIGTSTP_action = {0};
-    SIGTSTP_action.sa_handler = handle_SIGTSTP;
-    sigfillset(&SIGTSTP_action.sa_mask);
-    SIGTSTP_action.sa_flags = 0;
-    sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+    //set up the asynchronous background reaper. SA_RESTART keeps the handler
+    //from making fgets at the prompt fail with EINTR
+    struct sigaction SIGCHLD_action = {0};
+    SIGCHLD_action.sa_handler = handle_SIGCHLD;
+    sigfillset(&SIGCHLD_action.sa_mask);
+    SIGCHLD_action.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &SIGCHLD_action, NULL);
 
 
     //this while loop runs the shell until user decides to exit
     while(shell->exitShell != 1){
-        getCommandLineArguments(shell, MAX_ARGS);
+        //a ^Z during the previous command deferred its banner to here
+        reportModeToggle(shell);
 
-        //if command 'exit', kill all child processes and exit
-        if(strcmp(shell->cmdLineArgs[0], "exit") == 0){
-            exitSmallShell(shell);
-        }
-        
-        //print exit status
-        else if(strcmp(shell->cmdLineArgs[0], "status") == 0){
-            printShellStatus(shell);
-        }
+        getCommandLineArguments(shell);
 
-        //change directory
-        else if(strcmp(shell->cmdLineArgs[0], "cd") == 0){
-            changeShellDirectory(shell);
-        }
+        //input ran out (end of script or ^D), nothing left to run
+        if(shell->exitShell == 1)
+            break;
 
-        // all other commands create a new process
-        else{
-            createNewProcess(shell, SIGINT_action);
+        //run the whole command list parsed from this line: each segment
+        //executes, then the connector ahead of the next one is tested
+        //against the last exit status. a skipped segment still parses so
+        //the walk reaches whatever comes after it ("a && b ; c" runs c
+        //even when a fails)
+        int runSegment = 1;
+        while(shell->exitShell != 1){
+            if(runSegment && shell->cmdLineArgs[0] != NULL){
+                //builtins (exit, status, cd, ...) dispatch through the jump
+                //table; a builtin name at the head of a pipeline runs as an
+                //external command
+                void (*builtinHandler)(struct shell*) = NULL;
+                if(shell->numStages == 1)
+                    builtinHandler = lookupBuiltin(shell->cmdLineArgs[0]);
+
+                if(builtinHandler != NULL){
+                    builtinHandler(shell);
+                }
 
-            //clear any output in the buffer, otherwise ^Z will print previous message
-            fflush(stdout);
+                // all other commands create a new process
+                else{
+                    createNewProcess(shell);
+                }
+            }
+
+            if(shell->chainRest == NULL)
+                break;
+
+            //parse the next segment, then decide whether it runs: ";"
+            //always, "&&" only after success, "||" only after failure
+            int chainOp = shell->chainOp;
+            char* chainRest = shell->chainRest;
+            commandSegmentReset(shell);
+            parseCommandSegment(shell, chainRest);
+
+            int succeeded = WIFEXITED(shell->exitStatus) &&
+                            WEXITSTATUS(shell->exitStatus) == 0;
+            runSegment = chainOp == CHAIN_ALWAYS ||
+                         (chainOp == CHAIN_AND && succeeded) ||
+                         (chainOp == CHAIN_OR && !succeeded);
         }
 
+        //mark the line complete with the status its last segment finished on
+        if(shell->journalMap != NULL)
+            journalRecordComplete(shell, shell->scriptLineNext - 1, shell->exitStatus);
+
         commandLineArgumentReset(shell);
     }
 
-    //free up remaining memory in shell
-    free(shell);
+    //dump the accumulated histograms at exit when stats were asked for
+    if(getenv("SMALLSH_STATS") != NULL)
+        printShellStats(shell);
+
+    //let any pool workers drain their queued tasks and exit
+    stopWorkerPool(shell);
+
+    //free up remaining memory in shell, including any never-launched queued jobs
+    while(shell->bgQueueHead != NULL){
+        struct queuedJob* job = shell->bgQueueHead;
+        shell->bgQueueHead = job->next;
+        free(job->args);
+        free(job->argStorage);
+        free(job);
+    }
+    while(shell->dirStackCount > 0){
+        shell->dirStackCount--;
+        close(shell->dirStackFds[shell->dirStackCount]);
+        free(shell->dirStackPaths[shell->dirStackCount]);
+    }
+    pathCacheFlush(&shell->paths, 0);
+    free(shell->paths.entries);
+    for(int x = 0; x < shell->jobs.capacity; x++)
+        free(shell->jobs.cmds[x]);
+    free(shell->jobs.cmds);
+    free(shell->jobs.pids);
+    free(shell->cmdLineArgs);
+    //trim the journal to its real length so a resume never scans padding
+    if(shell->journalMap != NULL){
+        munmap(shell->journalMap, shell->journalCapacity);
+        if(ftruncate(shell->journalFd, shell->journalUsed) == -1)
+            fprintf(stderr, "smallsh: cannot trim journal\n");
+        close(shell->journalFd);
+    }
+    free(shell->scriptLines);
+    free(shell->scriptBuffer);
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file